@@ -3,14 +3,55 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 typedef struct Node Node;
 
+///// container.c :::
+
+// Growable stack of pointers
+typedef struct Stack Stack;
+struct Stack {
+   void **data;
+   int capacity;
+   int len;
+};
+
+void stack_push(Stack *s, void *elem);
+void *stack_pop(Stack *s);
+void *stack_peek(Stack *s);
+
+// Lock-free single-producer/single-consumer ring buffer of pointers.
+// Each side keeps a cached copy of the other side's index on its own
+// cache line, so the shared indices are only read when the cache runs out.
+typedef struct Queue Queue;
+struct Queue {
+   void **data;
+   size_t capacity;
+   alignas(64) _Atomic size_t head; // Next slot to pop; written by the consumer
+   size_t cached_tail;              // Consumer's view of `tail`
+   alignas(64) _Atomic size_t tail; // Next slot to push; written by the producer
+   size_t cached_head;              // Producer's view of `head`
+};
+
+void queue_init(Queue *q, int capacity);
+void queue_push(Queue *q, void *elem);
+void *queue_pop(Queue *q);
+
+   //;;;
+
 ///// tokenize.c :::
 
 typedef enum {
@@ -29,14 +70,21 @@ struct Token {
    int val;        // If kind is TK_NUM, its value
    char *loc;      // Token location
    int len;        // Token length
+   int line_no;    // Line number, 1-based
+   int col_no;     // Column number, 1-based
 };
 
+extern int error_count;                     // Number of diagnostics reported so far
+extern _Thread_local jmp_buf *error_recover; // If set, error_at/error_tok longjmp here instead of exiting
+
 void error(char *fmt, ...);
 void error_at(char *loc, char *fmt, ...);
 void error_tok(Token *tok, char *fmt, ...);
 bool equal(Token *tok, char *op);
 Token *skip(Token *tok, char *op);
-Token *tokenize(char *input);
+Token *tokenize(char *filename, char *input);
+void tokenize_to_queue(char *filename, char *input, Queue *q);
+int source_offset(char *loc);
 
    //;;;
 //// parse.c :::
@@ -44,8 +92,14 @@ Token *tokenize(char *input);
 typedef struct Obj Obj;
 struct Obj {
    Obj *next;
-   char *name; // Variable name
-   int offset; // Offset from RBP
+   char *name;    // Variable name
+   char *reg;     // Register holding it, or NULL if it lives on the stack
+   int offset;    // Offset from %rsp between statements
+   long uses;     // Number of references, weighted by profile counts
+   int first_use; // Index of the first statement mentioning it
+   int last_use;  // Index of the last statement mentioning it
+   int id;        // Index into codegen's per-local tables
+   bool opaque;   // Listed in -fopaque, so its values have no known range
 };
 
 typedef struct Function Function;
@@ -78,12 +132,36 @@ struct Node {
    Node *next;    // Next node
    Node *lhs;     // Left-hand side
    Node *rhs;     // Right-hand side
+   Token *tok;    // Representative token
    Obj *var;      // Used if kind == ND_VAR
    int val;       // Used if kind == ND_NUM
 };
 
 Function *parse(Token *tok);
+Function *parse_queue(Queue *q);
    //;;;
 ///// codegen.c :::
+#define PROFILE_FILE "9cc.prof" // Written by -finstrument-stmts binaries at exit
+
+void load_profile(char *path);
 void codegen(Function *prog);
    // ;;;
+///// superopt.c :::
+#define SUPEROPT_MAX_NODES 7  // Largest pattern, in nodes
+#define SUPEROPT_MAX_INPUTS 2 // Pattern variables, passed in %rdi and %rdx
+
+void load_superopt_rules(char *path);
+bool have_superopt_rules(void);
+char *superopt_key(Node *node, Obj **inputs, int *ninputs);
+char *superopt_lookup(Node *node, Obj **inputs, int *ninputs);
+   // ;;;
+///// main.c :::
+extern char *base_file;    // Path of the input, as given on the command line
+extern int opt_level;      // 0 disables register allocation, slot sharing, the red zone and value ranges
+extern bool opt_hash_cons; // Share structurally identical pure subtrees
+extern bool opt_g;         // Emit line-number debug info and CFI
+extern bool opt_instrument_stmts; // Count statement executions into PROFILE_FILE
+extern bool opt_pipeline;  // Tokenize, parse and generate code on separate threads
+extern int opt_codegen_threads; // Codegen threads for -fpipeline=N; 0 means one per CPU
+extern char *opt_opaque;   // Comma-separated locals whose values value ranges must not assume
+   // ;;;
@@ -0,0 +1,62 @@
+a=1; b=2; c=3; d=4;
+c = (a + d) * 8 + c / 7 - 9;
+d = (c + b) * 4 + d / 3 - 36;
+c = (a * d) * 3 + c / 2 - 48;
+c = (a + b) * 6 + c / 6 - 49;
+c = (b - a) * 4 + c / 4 - 74;
+d = (d + a) * 3 + d / 3 - 57;
+c = (d * a) * 6 + c / 5 - 23;
+d = (c + b) * 9 + d / 8 - 60;
+c = (b - d) * 4 + c / 5 - 21;
+c = (c - a) * 3 + c / 6 - 53;
+b = (d * b) * 7 + b / 9 - 9;
+a = (a - b) * 7 + a / 4 - 99;
+b = (d - b) * 7 + b / 6 - 1;
+c = (a - d) * 3 + c / 6 - 11;
+d = (b * d) * 4 + d / 9 - 24;
+c = (d + a) * 9 + c / 7 - 77;
+b = (b * d) * 9 + b / 9 - 3;
+d = (d - c) * 8 + d / 4 - 19;
+a = (d * b) * 6 + a / 4 - 67;
+d = (d - a) * 6 + d / 9 - 86;
+c = (a + c) * 4 + c / 6 - 86;
+a = (c + a) * 9 + a / 9 - 64;
+c = (b * c) * 7 + c / 3 - 44;
+c = (c * b) * 2 + c / 7 - 40;
+b = (d - c) * 2 + b / 2 - 9;
+a = (d * a) * 6 + a / 8 - 78;
+a = (b - d) * 3 + a / 9 - 83;
+c = (b + a) * 8 + c / 7 - 28;
+c = (a - b) * 4 + c / 5 - 91;
+b = (a * c) * 5 + b / 2 - 88;
+a = (c + b) * 7 + a / 6 - 48;
+d = (b - c) * 9 + d / 6 - 76;
+c = (c + b) * 3 + c / 2 - 89;
+b = (b - d) * 9 + b / 8 - 15;
+b = (d - a) * 4 + b / 3 - 63;
+b = (c - d) * 4 + b / 6 - 50;
+a = (c - b) * 6 + a / 3 - 97;
+a = (d * a) * 3 + a / 4 - 89;
+a = (c - d) * 2 + a / 2 - 91;
+a = (c - b) * 2 + a / 5 - 62;
+b = (b + c) * 4 + b / 4 - 52;
+c = (c + b) * 7 + c / 3 - 90;
+d = (c * d) * 3 + d / 3 - 10;
+c = (b * d) * 9 + c / 2 - 75;
+a = (c - b) * 3 + a / 2 - 27;
+a = (a * b) * 9 + a / 8 - 91;
+a = (a * d) * 9 + a / 7 - 89;
+b = (a - d) * 6 + b / 8 - 65;
+b = (d + c) * 8 + b / 5 - 18;
+b = (a * c) * 3 + b / 8 - 97;
+b = (b + c) * 9 + b / 7 - 16;
+d = (a - d) * 3 + d / 8 - 43;
+d = (d * b) * 5 + d / 2 - 6;
+c = (d * b) * 6 + c / 3 - 51;
+d = (d - c) * 5 + d / 2 - 45;
+c = (c - a) * 8 + c / 7 - 91;
+c = (d - a) * 6 + c / 4 - 95;
+b = (b * a) * 7 + b / 5 - 79;
+b = (b + d) * 4 + b / 8 - 3;
+d = (d - c) * 7 + d / 7 - 96;
+return a + b + c + d;
@@ -0,0 +1,42 @@
+a=7; b=3; c=5; d=11;
+d = d + (a < b) + (d >= b) * 2 - ((a == d) != (b <= b));
+a = a + (d < b) + (c >= a) * 2 - ((d == c) != (b <= a));
+b = b + (c < a) + (c >= d) * 2 - ((c == c) != (a <= d));
+d = d + (d < b) + (d >= a) * 2 - ((d == d) != (b <= a));
+b = b + (c < d) + (b >= a) * 2 - ((c == b) != (d <= a));
+a = a + (b < c) + (a >= d) * 2 - ((b == a) != (c <= d));
+c = c + (a < a) + (b >= d) * 2 - ((a == b) != (a <= d));
+a = a + (b < b) + (a >= c) * 2 - ((b == a) != (b <= c));
+c = c + (d < c) + (b >= a) * 2 - ((d == b) != (c <= a));
+d = d + (a < d) + (c >= c) * 2 - ((a == c) != (d <= c));
+c = c + (a < b) + (a >= d) * 2 - ((a == a) != (b <= d));
+a = a + (b < d) + (d >= a) * 2 - ((b == d) != (d <= a));
+a = a + (d < b) + (d >= b) * 2 - ((d == d) != (b <= b));
+c = c + (c < d) + (b >= b) * 2 - ((c == b) != (d <= b));
+a = a + (a < c) + (d >= d) * 2 - ((a == d) != (c <= d));
+b = b + (c < d) + (b >= b) * 2 - ((c == b) != (d <= b));
+a = a + (a < a) + (a >= b) * 2 - ((a == a) != (a <= b));
+b = b + (c < b) + (b >= d) * 2 - ((c == b) != (b <= d));
+d = d + (c < a) + (a >= b) * 2 - ((c == a) != (a <= b));
+c = c + (a < d) + (a >= a) * 2 - ((a == a) != (d <= a));
+d = d + (d < a) + (b >= a) * 2 - ((d == b) != (a <= a));
+d = d + (d < d) + (b >= d) * 2 - ((d == b) != (d <= d));
+c = c + (c < d) + (c >= a) * 2 - ((c == c) != (d <= a));
+a = a + (a < c) + (c >= a) * 2 - ((a == c) != (c <= a));
+c = c + (d < d) + (b >= d) * 2 - ((d == b) != (d <= d));
+c = c + (d < b) + (b >= c) * 2 - ((d == b) != (b <= c));
+b = b + (a < a) + (d >= b) * 2 - ((a == d) != (a <= b));
+b = b + (d < a) + (c >= d) * 2 - ((d == c) != (a <= d));
+c = c + (c < b) + (b >= a) * 2 - ((c == b) != (b <= a));
+a = a + (b < a) + (d >= a) * 2 - ((b == d) != (a <= a));
+a = a + (c < c) + (d >= b) * 2 - ((c == d) != (c <= b));
+a = a + (a < b) + (a >= b) * 2 - ((a == a) != (b <= b));
+c = c + (b < c) + (d >= b) * 2 - ((b == d) != (c <= b));
+b = b + (b < c) + (b >= c) * 2 - ((b == b) != (c <= c));
+b = b + (a < c) + (b >= d) * 2 - ((a == b) != (c <= d));
+a = a + (c < d) + (d >= a) * 2 - ((c == d) != (d <= a));
+a = a + (c < b) + (b >= c) * 2 - ((c == b) != (b <= c));
+d = d + (c < d) + (a >= a) * 2 - ((c == a) != (d <= a));
+c = c + (c < a) + (b >= a) * 2 - ((c == b) != (a <= a));
+a = a + (b < d) + (a >= c) * 2 - ((b == a) != (d <= c));
+return a + b + c + d;
@@ -0,0 +1,42 @@
+a=1; b=2; c=3; d=4; e=5; f=6; g=7; h=8; i=9; j=10; k=11; l=12; m=13; n=14; o=15; p=16; q=17; r=18; s=19; t=20;
+l = j + t * m - l;
+r = s + f * d - r;
+h = p + o * q - h;
+m = i + m * t - m;
+l = f + c * t - l;
+a = e + q * s - a;
+a = n + h * p - a;
+h = b + q * j - h;
+t = k + c * h - t;
+i = a + h * l - i;
+n = n + t * j - n;
+k = p + c * m - k;
+l = k + g * f - l;
+d = s + p * k - d;
+c = b + j * p - c;
+t = r + j * o - t;
+k = r + i * m - k;
+f = n + c * k - f;
+o = f + o * b - o;
+l = r + g * i - l;
+f = n + q * e - f;
+a = p + b * t - a;
+n = a + n * k - n;
+i = a + r * t - i;
+k = l + c * e - k;
+r = n + h * q - r;
+s = g + m * a - s;
+r = f + g * n - r;
+t = m + s * j - t;
+j = q + p * m - j;
+c = j + s * o - c;
+f = r + q * k - f;
+n = l + d * f - n;
+e = b + e * t - e;
+a = e + k * q - a;
+l = f + r * k - l;
+k = f + p * q - k;
+r = h + t * j - r;
+n = m + a * p - n;
+g = e + i * h - g;
+return a + b + c + d + e + f + g + h + i + j + k + l + m + n + o + p + q + r + s + t;
@@ -1,99 +1,477 @@
 //codegen.c
 #include "9cc.h"
 
-static int depth;
+// With -fpipeline statements are generated on several threads, each
+// into its own buffer, so all per-statement state is thread-local.
+static _Thread_local FILE *out;
+static _Thread_local int depth;
+
+// Registers that can hold locals, cheapest first. main is a leaf and
+// codegen itself only touches %rax, %rdi and %rdx, so the caller-saved
+// ones are free for the taking; the callee-saved ones must be preserved.
+static char *lvar_regs[] = {
+   "%rsi", "%rcx", "%r8", "%r9", "%r10", "%r11",
+   "%rbx", "%r12", "%r13", "%r14", "%r15",
+};
+static char *lvar_regs32[] = {
+   "%esi", "%ecx", "%r8d", "%r9d", "%r10d", "%r11d",
+   "%ebx", "%r12d", "%r13d", "%r14d", "%r15d",
+};
+#define NUM_CALLER_SAVED 6
+#define NUM_LVAR_REGS (sizeof(lvar_regs) / sizeof(*lvar_regs))
+
+// Callee-saved registers used by the current function, in push order.
+static char *saved_regs[NUM_LVAR_REGS];
+static int num_saved_regs;
+
+// Statement execution counts read by load_profile(), sorted by offset.
+typedef struct ProfileEntry ProfileEntry;
+struct ProfileEntry {
+   long offset;
+   long count;
+};
+
+static ProfileEntry *profile;
+static int profile_len;
+
+// The values an expression can take, as an interval of 64-bit integers.
+// Results known to lie in [0, UINT32_MAX] are computed with 32-bit
+// instructions, which zero the upper half of the register for free and
+// mostly encode without a REX prefix.
+typedef struct Range Range;
+struct Range {
+   int64_t lo;
+   int64_t hi;
+};
+
+#define FULL_RANGE ((Range){INT64_MIN, INT64_MAX})
+
+// Ranges of the operands emitted so far, innermost last, and of each
+// local after the statements generated so far on this thread.
+static _Thread_local Range *ranges;
+static _Thread_local int ranges_len, ranges_cap;
+static _Thread_local Range *lvar_ranges;
+static int num_lvars;
+
+static void cfi(char *fmt, ...) { //::: Emit a CFI directive with -g.
+   if (!opt_g)
+      return;
+
+   va_list ap;
+   va_start(ap, fmt);
+   fprintf(out, "   ");
+   vfprintf(out, fmt, ap);
+   fprintf(out, "\n");
+   va_end(ap);
+} //;;;
+
+static void gen_loc(Token *tok) { //::: Emit a .loc directive for `tok` with -g, unless it would repeat the last one.
+   static _Thread_local int last_line, last_col;
+   if (!opt_g || (tok->line_no == last_line && tok->col_no == last_col))
+      return;
+
+   fprintf(out, "   .loc 1 %d %d\n", tok->line_no, tok->col_no);
+   last_line = tok->line_no;
+   last_col = tok->col_no;
+} //;;;
+
+static void gen_expr_loc(Node *node) { //:::
+   // Hash-consed nodes carry the token of their first occurrence, which
+   // may be on another line, so only statements get locations then.
+   if (!opt_hash_cons)
+      gen_loc(node->tok);
+} //;;;
 
 static void push(void) { //:::
-   printf("   push %%rax\n");
+   fprintf(out, "   push %%rax\n");
+   cfi(".cfi_adjust_cfa_offset 8");
    depth++;
 } //;;;
 
 static void pop(char *arg) { //:::
-   printf("   pop %s\n", arg);
+   fprintf(out, "   pop %s\n", arg);
+   cfi(".cfi_adjust_cfa_offset -8");
    depth--;
 } //;;;
 
-static int align_to(int n, int align) {
-  return (n + align - 1) / align * align; //::: Round up `n` to the nearest multiple of `align`. For instance, align_to(5, 8) returns 8 and align_to(11, 8) returns 16.
+// Expression trees are walked with an explicit stack of frames rather
+// than by recursion, so arbitrarily deep expressions cannot overflow our
+// stack.
+typedef struct Frame Frame;
+struct Frame {
+   Node *node;
+   int state; // Operands emitted so far, or the push depth in analyze()
+};
+
+static _Thread_local Frame *frames;
+static _Thread_local int frames_cap;
+
+static void push_frame(int *sp, Node *node, int state) { //:::
+   if (*sp == frames_cap) {
+      frames_cap = frames_cap ? frames_cap * 2 : 64;
+      frames = realloc(frames, sizeof(Frame) * frames_cap);
+   }
+   frames[(*sp)++] = (Frame){node, state};
 } //;;;
 
-static void gen_addr(Node *node) {
-   if (node->kind == ND_VAR) {
-      printf("   lea %d(%%rbp), %%rax\n", node->var->offset);
-      return;
+static char *var_operand(Node *node) { //::: Returns the operand that holds the variable `node` refers to.
+   static _Thread_local char buf[32];
+   if (node->kind != ND_VAR)
+      error("not an lvalue");
+   if (node->var->reg)
+      return node->var->reg;
+
+   // Locals are addressed from %rsp, which moves with every push.
+   snprintf(buf, sizeof(buf), "%d(%%rsp)", node->var->offset + depth * 8);
+   return buf;
+} //;;;
+
+static char *var_operand32(Node *node) { //::: The low half of var_operand(node).
+   for (int i = 0; i < NUM_LVAR_REGS; i++)
+      if (node->var->reg == lvar_regs[i])
+         return lvar_regs32[i];
+   return var_operand(node);
+} //;;;
+
+static void push_range(Range r) { //:::
+   if (ranges_len == ranges_cap) {
+      ranges_cap = ranges_cap ? ranges_cap * 2 : 64;
+      ranges = realloc(ranges, sizeof(Range) * ranges_cap);
    }
+   // -O0 is the fuzzer's baseline, so it assumes nothing.
+   ranges[ranges_len++] = opt_level > 0 ? r : FULL_RANGE;
+} //;;;
 
-   error("not an lvalue");
+static Range pop_range(void) { //:::
+   return ranges[--ranges_len];
 } //;;;
 
-static void gen_expr(Node *node) {  // Generate code for a given node. ::: 
-   switch (node->kind) {
-   case ND_NUM:
-      printf("   mov $%d, %%rax\n", node->val);
-      return;
-   case ND_NEG:
-      gen_expr(node->lhs);
-      printf("   neg %%rax\n");
-      return;
-   case ND_VAR:
-      gen_addr(node);
-      printf("   mov (%%rax), %%rax\n");
+static void forget_lvar_ranges(void) { //:::
+   if (!lvar_ranges)
+      lvar_ranges = calloc(num_lvars, sizeof(Range));
+   for (int i = 0; i < num_lvars; i++)
+      lvar_ranges[i] = FULL_RANGE;
+} //;;;
+
+static bool within(Range r, int64_t lo, int64_t hi) { //:::
+   return lo <= r.lo && r.hi <= hi;
+} //;;;
+
+static bool contains(Range r, int64_t val) { //:::
+   return r.lo <= val && val <= r.hi;
+} //;;;
+
+static bool fits32(Range r) { //::: Whether a 32-bit instruction computes the full 64-bit result.
+   return within(r, 0, UINT32_MAX);
+} //;;;
+
+static Range range_neg(Range x) { //:::
+   return x.lo == INT64_MIN ? FULL_RANGE : (Range){-x.hi, -x.lo};
+} //;;;
+
+static Range range_add(Range x, Range y) { //:::
+   Range r;
+   if (__builtin_add_overflow(x.lo, y.lo, &r.lo) || __builtin_add_overflow(x.hi, y.hi, &r.hi))
+      return FULL_RANGE;
+   return r;
+} //;;;
+
+static Range range_sub(Range x, Range y) { //:::
+   Range r;
+   if (__builtin_sub_overflow(x.lo, y.hi, &r.lo) || __builtin_sub_overflow(x.hi, y.lo, &r.hi))
+      return FULL_RANGE;
+   return r;
+} //;;;
+
+static Range range_mul(Range x, Range y) { //:::
+   int64_t c[4];
+   if (__builtin_mul_overflow(x.lo, y.lo, &c[0]) || __builtin_mul_overflow(x.lo, y.hi, &c[1]) ||
+       __builtin_mul_overflow(x.hi, y.lo, &c[2]) || __builtin_mul_overflow(x.hi, y.hi, &c[3]))
+      return FULL_RANGE;
+
+   Range r = {c[0], c[0]};
+   for (int i = 1; i < 4; i++) {
+      r.lo = c[i] < r.lo ? c[i] : r.lo;
+      r.hi = c[i] > r.hi ? c[i] : r.hi;
+   }
+   return r;
+} //;;;
+
+static Range range_div(Range x, Range y) { //:::
+   // Truncating division is monotonic in each operand while the divisor
+   // keeps its sign, so the corners bound the quotient.
+   if (contains(y, 0) || (x.lo == INT64_MIN && contains(y, -1)))
+      return FULL_RANGE;
+
+   int64_t c[4] = {x.lo / y.lo, x.lo / y.hi, x.hi / y.lo, x.hi / y.hi};
+   Range r = {c[0], c[0]};
+   for (int i = 1; i < 4; i++) {
+      r.lo = c[i] < r.lo ? c[i] : r.lo;
+      r.hi = c[i] > r.hi ? c[i] : r.hi;
+   }
+   return r;
+} //;;;
+
+// Returns whether a comparison of this kind always yields `*val` for
+// operands in these ranges.
+static bool decided(NodeKind kind, Range x, Range y, int *val) { //:::
+   bool lt = x.hi < y.lo, ge = x.lo >= y.hi;
+   bool le = x.hi <= y.lo, gt = x.lo > y.hi;
+   bool eq = x.lo == x.hi && y.lo == y.hi && x.lo == y.lo;
+
+   switch (kind) {
+   case ND_EQ: *val = eq; return eq || lt || gt;
+   case ND_NE: *val = !eq; return eq || lt || gt;
+   case ND_LT: *val = lt; return lt || ge;
+   case ND_LE: *val = le; return le || gt;
+   }
+   return false;
+} //;;;
+
+static void gen_div(Range x, Range y) { //::: Divide %rax by %rdi, as cheaply as the operand ranges allow.
+   // Non-negative operands need no sign extension: unsigned division
+   // gives the same quotient, and 32-bit division when both fit.
+   if (x.lo >= 0 && y.lo >= 1) {
+      fprintf(out, "   xor %%edx, %%edx\n");
+      if (fits32(x) && fits32(y))
+         fprintf(out, "   div %%edi\n");
+      else
+         fprintf(out, "   div %%rdi\n");
       return;
-   case ND_ASSIGN:
-      gen_addr(node->lhs);
-      push();
-      gen_expr(node->rhs);
-      pop("%rdi");
-      printf("   mov %%rax, (%%rdi)\n");
+   }
+
+   // 32-bit signed division, unless it could trap on INT32_MIN / -1.
+   if (within(x, INT32_MIN, INT32_MAX) && within(y, INT32_MIN, INT32_MAX) &&
+       !contains(y, 0) && !(x.lo == INT32_MIN && contains(y, -1))) {
+      fprintf(out, "   cltd\n");
+      fprintf(out, "   idiv %%edi\n");
+      if (range_div(x, y).lo < 0)
+         fprintf(out, "   cltq\n");
       return;
    }
-   gen_expr(node->rhs);
-   push();
-   gen_expr(node->lhs);
-   pop("%rdi");
+
+   fprintf(out, "   cqo\n");
+   fprintf(out, "   idiv %%rdi\n");
+} //;;;
+
+// Apply a binary operator to %rax (lhs) and %rdi (rhs), whose values lie
+// in `x` and `y`, and return the range of the result.
+static Range gen_binary(Node *node, Range x, Range y) { //:::
+   Range r = FULL_RANGE;
 
    switch (node->kind) {
    case ND_ADD:
-      printf("   add %%rdi, %%rax\n");
-      return;
+      r = range_add(x, y);
+      fprintf(out, fits32(r) ? "   add %%edi, %%eax\n" : "   add %%rdi, %%rax\n");
+      return r;
    case ND_SUB:
-      printf("   sub %%rdi, %%rax\n");
-      return;
+      r = range_sub(x, y);
+      fprintf(out, fits32(r) ? "   sub %%edi, %%eax\n" : "   sub %%rdi, %%rax\n");
+      return r;
    case ND_MUL:
-      printf("   imul %%rdi, %%rax\n");
-      return;
+      r = range_mul(x, y);
+      fprintf(out, fits32(r) ? "   imul %%edi, %%eax\n" : "   imul %%rdi, %%rax\n");
+      return r;
    case ND_DIV:
-      printf("   cqo\n");
-      printf("   idiv %%rdi\n");
-      return;
+      gen_div(x, y);
+      return range_div(x, y);
 
    case ND_EQ:
    case ND_NE:
    case ND_LT:
-   case ND_LE:
-      printf("   cmp %%rdi, %%rax\n");
+   case ND_LE: {
+      int val;
+      if (decided(node->kind, x, y, &val)) {
+         fprintf(out, "   mov $%d, %%eax\n", val);
+         return (Range){val, val};
+      }
+
+      // Values that fit in 32 bits compare the same in their low halves.
+      bool narrow = within(x, INT32_MIN, INT32_MAX) && within(y, INT32_MIN, INT32_MAX);
+      fprintf(out, narrow ? "   cmp %%edi, %%eax\n" : "   cmp %%rdi, %%rax\n");
 
       if (node->kind == ND_EQ)
-         printf("   sete %%al\n");
+         fprintf(out, "   sete %%al\n");
       else if (node->kind == ND_NE)
-         printf("   setne %%al\n");
+         fprintf(out, "   setne %%al\n");
       else if (node->kind == ND_LT)
-         printf("   setl %%al\n");
+         fprintf(out, "   setl %%al\n");
       else if (node->kind == ND_LE)
-         printf("   setle %%al\n");
+         fprintf(out, "   setle %%al\n");
 
-      printf("   movzb %%al, %%rax\n");
-      return;
+      // setcc writes only %al; the rest is already zero if the lhs was
+      // a byte.
+      if (!within(x, 0, 255))
+         fprintf(out, "   movzbl %%al, %%eax\n");
+      return (Range){0, 1};
+   }
    }
 
    error("invalid expression");
 } //;;;
 
-static void gen_stmt(Node *node) {  // :::
+// Store the range of a superoptimiser pattern's value in `*r`, or return
+// false if the ranges decide a comparison in it, which the range code
+// folds to a constant more cheaply than any rule.
+static bool pattern_range(Node *node, Range *r) { //:::
+   if (node->kind == ND_NUM) {
+      *r = (Range){node->val, node->val};
+      return true;
+   }
+   if (node->kind == ND_VAR) {
+      *r = lvar_ranges[node->var->id];
+      return true;
+   }
+
+   Range x, y = FULL_RANGE;
+   if (!pattern_range(node->lhs, &x) || (node->rhs && !pattern_range(node->rhs, &y)))
+      return false;
+
+   int val;
+   switch (node->kind) {
+   case ND_NEG: *r = range_neg(x); return true;
+   case ND_ADD: *r = range_add(x, y); return true;
+   case ND_SUB: *r = range_sub(x, y); return true;
+   case ND_MUL: *r = range_mul(x, y); return true;
+   }
+   *r = (Range){0, 1};
+   return !decided(node->kind, x, y, &val);
+} //;;;
+
+// Emit `node` from a superoptimiser rule, if one applies, and store the
+// range of its value in `*r`.
+static bool gen_superopt(Node *node, Range *r) { //:::
+   if (!have_superopt_rules())
+      return false;
+
+   Obj *inputs[SUPEROPT_MAX_INPUTS];
+   int ninputs;
+   char *insns = superopt_lookup(node, inputs, &ninputs);
+   if (!insns || !pattern_range(node, r))
+      return false;
+
+   gen_expr_loc(node);
+   static char *input_regs[] = {"%rdi", "%rdx"};
+   Node var = {.kind = ND_VAR};
+   for (int i = 0; i < ninputs; i++) {
+      var.var = inputs[i];
+      fprintf(out, "   mov %s, %s\n", var_operand(&var), input_regs[i]);
+   }
+   for (char *p = insns; *p;) {
+      int len = strcspn(p, "\n");
+      fprintf(out, "   %.*s\n", len, p);
+      p += len + (p[len] == '\n');
+   }
+   return true;
+} //;;;
+
+static void gen_expr(Node *node) {  // Generate code for a given node. ::: 
+   int sp = 0;
+   push_frame(&sp, node, 0);
+
+   while (sp > 0) {
+      Frame *f = &frames[sp - 1];
+      Node *node = f->node;
+
+      Range r;
+      if (f->state == 0 && gen_superopt(node, &r)) {
+         push_range(r);
+         sp--;
+         continue;
+      }
+
+      switch (node->kind) {
+      case ND_NUM:
+         gen_expr_loc(node);
+         push_range((Range){node->val, node->val});
+         if (fits32(ranges[ranges_len - 1]))
+            fprintf(out, "   mov $%d, %%eax\n", node->val);
+         else
+            fprintf(out, "   mov $%d, %%rax\n", node->val);
+         sp--;
+         continue;
+      case ND_VAR:
+         gen_expr_loc(node);
+         push_range(lvar_ranges[node->var->id]);
+         if (fits32(ranges[ranges_len - 1]))
+            fprintf(out, "   mov %s, %%eax\n", var_operand32(node));
+         else
+            fprintf(out, "   mov %s, %%rax\n", var_operand(node));
+         sp--;
+         continue;
+      case ND_NEG:
+         if (f->state++ == 0) {
+            push_frame(&sp, node->lhs, 0);
+            continue;
+         }
+         gen_expr_loc(node);
+         push_range(range_neg(pop_range()));
+         if (fits32(ranges[ranges_len - 1]))
+            fprintf(out, "   neg %%eax\n");
+         else
+            fprintf(out, "   neg %%rax\n");
+         sp--;
+         continue;
+      case ND_ASSIGN:
+         if (f->state++ == 0) {
+            var_operand(node->lhs);
+            push_frame(&sp, node->rhs, 0);
+            continue;
+         }
+         gen_expr_loc(node);
+         fprintf(out, "   mov %%rax, %s\n", var_operand(node->lhs));
+         // Like an empty asm in C, -fopaque hides what was assigned.
+         lvar_ranges[node->lhs->var->id] = node->lhs->var->opaque ? FULL_RANGE : ranges[ranges_len - 1];
+         sp--;
+         continue;
+      }
+
+      // Binary operators: rhs, push, lhs, pop into %rdi.
+      switch (f->state++) {
+      case 0:
+         push_frame(&sp, node->rhs, 0);
+         continue;
+      case 1:
+         push();
+         push_frame(&sp, node->lhs, 0);
+         continue;
+      }
+      gen_expr_loc(node);
+      pop("%rdi");
+      Range x = pop_range();
+      Range y = pop_range();
+      push_range(gen_binary(node, x, y));
+      sp--;
+   }
+   ranges_len--;
+} //;;;
+
+static void gen_epilogue(Function *prog) { //:::
+   // Code may follow a return, so restore the unwind state after the ret.
+   cfi(".cfi_remember_state");
+   if (prog->stack_size) {
+      fprintf(out, "   add $%d, %%rsp\n", prog->stack_size);
+      cfi(".cfi_adjust_cfa_offset -%d", prog->stack_size);
+   }
+   for (int i = num_saved_regs - 1; i >= 0; i--) {
+      fprintf(out, "   pop %s\n", saved_regs[i]);
+      cfi(".cfi_adjust_cfa_offset -8");
+      cfi(".cfi_restore %s", saved_regs[i]);
+   }
+   fprintf(out, "   ret\n");
+   cfi(".cfi_restore_state");
+} //;;;
+
+static void gen_stmt(Function *prog, Node *node, int idx) {  // :::
+   gen_loc(node->tok);
+
+   if (opt_instrument_stmts)
+      fprintf(out, "   incq .L.prof.counters+%d(%%rip)\n", idx * 8);
+
    switch (node->kind) {
    case ND_RETURN:
       gen_expr(node->lhs);
-      printf("  jmp .L.return\n");
+      gen_epilogue(prog);
       return;
    case ND_EXPR_STMT:
       gen_expr(node->lhs);
@@ -103,35 +481,388 @@ static void gen_stmt(Node *node) {  // :::
    error("invalid statement");
 } //;;;
 
-static void assign_lvar_offsets(Function *prog) { //::: Assign offsets to local variables.
-   int offset = 0;
+static int by_offset(const void *a, const void *b) { //:::
+   long x = ((ProfileEntry *)a)->offset;
+   long y = ((ProfileEntry *)b)->offset;
+   return (x > y) - (x < y);
+} //;;;
+
+// Read a profile written by a -finstrument-stmts binary: one
+// "<source offset> <count>" pair per line, '#' starting a comment.
+void load_profile(char *path) { //:::
+   FILE *fp = fopen(path, "r");
+   if (!fp)
+      error("cannot open %s: %s", path, strerror(errno));
+
+   int capacity = 0;
+   char line[256];
+   while (fgets(line, sizeof(line), fp)) {
+      long offset, count;
+      if (line[0] == '#' || sscanf(line, "%ld %ld", &offset, &count) != 2)
+         continue;
+      if (profile_len == capacity) {
+         capacity = capacity ? capacity * 2 : 256;
+         profile = realloc(profile, sizeof(ProfileEntry) * capacity);
+      }
+      profile[profile_len++] = (ProfileEntry){offset, count};
+   }
+   fclose(fp);
+
+   qsort(profile, profile_len, sizeof(ProfileEntry), by_offset);
+} //;;;
+
+static long stmt_weight(Node *stmt) { //::: How often `stmt` ran according to the profile; 1 without one.
+   if (!profile)
+      return 1;
+
+   ProfileEntry key = {source_offset(stmt->tok->loc)};
+   ProfileEntry *ent = bsearch(&key, profile, profile_len, sizeof(ProfileEntry), by_offset);
+   return ent ? ent->count : 1;
+} //;;;
+
+static int analyze(Function *prog) { //::: Record each local's live range and return the deepest temporary push.
+   num_lvars = 0;
    for (Obj *var = prog->locals; var; var = var->next) {
-      offset += 8;
-      var->offset = -offset;
+      var->first_use = var->last_use = -1;
+      var->uses = 0;
+      var->id = num_lvars++;
    }
-   prog->stack_size = align_to(offset, 16);
+
+   int max_depth = 0;
+   int i = 0;
+   for (Node *stmt = prog->body; stmt; stmt = stmt->next, i++) {
+      long weight = stmt_weight(stmt);
+      int sp = 0;
+      push_frame(&sp, stmt->lhs, 0);
+
+      // Mirrors gen_expr: a binary node pushes its rhs before evaluating lhs.
+      while (sp > 0) {
+         Frame f = frames[--sp];
+         Node *node = f.node;
+
+         switch (node->kind) {
+         case ND_NUM:
+            continue;
+         case ND_VAR:
+            node->var->uses += weight;
+            if (node->var->first_use < 0)
+               node->var->first_use = i;
+            node->var->last_use = i;
+            continue;
+         case ND_NEG:
+            push_frame(&sp, node->lhs, f.state);
+            continue;
+         case ND_ASSIGN:
+            push_frame(&sp, node->lhs, f.state);
+            push_frame(&sp, node->rhs, f.state);
+            continue;
+         }
+
+         if (f.state + 1 > max_depth)
+            max_depth = f.state + 1;
+         push_frame(&sp, node->rhs, f.state);
+         push_frame(&sp, node->lhs, f.state + 1);
+      }
+   }
+   return max_depth;
 } //;;;
 
-void codegen(Function *prog) {
-   assign_lvar_offsets(prog);
+static int by_first_use(const void *a, const void *b) { //:::
+   return (*(Obj **)a)->first_use - (*(Obj **)b)->first_use;
+} //;;;
 
-   printf("   .globl main\n");
-   printf("main:\n");
+static int by_uses(const void *a, const void *b) { //::: Most used first; ties broken by first use.
+   Obj *x = *(Obj **)a;
+   Obj *y = *(Obj **)b;
+   if (x->uses != y->uses)
+      return x->uses < y->uses ? 1 : -1;
+   return x->first_use - y->first_use;
+} //;;;
+
+static bool overlaps(Obj *x, Obj *y) { //:::
+   return x->first_use <= y->last_use && y->first_use <= x->last_use;
+} //;;;
+
+// Give registers to the most used locals. A register can be shared by
+// locals whose live ranges do not overlap.
+static void assign_lvar_regs(Obj **vars, int n) { //:::
+   Stack owners[NUM_LVAR_REGS] = {};
+   num_saved_regs = 0;
+
+   qsort(vars, n, sizeof(Obj *), by_uses);
+
+   for (int i = 0; i < n; i++) {
+      for (int r = 0; r < NUM_LVAR_REGS; r++) {
+         bool busy = false;
+         for (int j = 0; j < owners[r].len && !busy; j++)
+            busy = overlaps(vars[i], owners[r].data[j]);
+         if (busy)
+            continue;
+
+         if (r >= NUM_CALLER_SAVED && owners[r].len == 0)
+            saved_regs[num_saved_regs++] = lvar_regs[r];
+         stack_push(&owners[r], vars[i]);
+         vars[i]->reg = lvar_regs[r];
+         break;
+      }
+   }
+
+   for (int r = 0; r < NUM_LVAR_REGS; r++)
+      free(owners[r].data);
+} //;;;
 
-   // Prologue
-   printf("   push %%rbp\n");
-   printf("   mov %%rsp, %%rbp\n");
-   printf("   sub $%d, %%rsp\n", prog->stack_size);
+// Assign registers, then stack slots, to local variables. Statements are
+// straight-line code, so a local is live from the first to the last
+// statement that mentions it, and locals whose ranges do not overlap
+// share a register or a slot.
+static void assign_lvar_locations(Function *prog) { //:::
+   int max_depth = analyze(prog);
 
-   for (Node *n = prog->body; n; n = n->next) {
-      gen_stmt(n);
+   int nvars = 0;
+   for (Obj *var = prog->locals; var; var = var->next)
+      nvars++;
+
+   Obj **vars = calloc(nvars, sizeof(Obj *));
+   int n = 0;
+   for (Obj *var = prog->locals; var; var = var->next)
+      if (var->first_use >= 0)
+         vars[n++] = var;
+
+   // At -O0 every local gets a slot of its own and %rsp is always moved,
+   // which gives the differential fuzzer a simple baseline to compare to.
+   if (opt_level > 0)
+      assign_lvar_regs(vars, n);
+
+   // Whatever did not get a register is spilled to the stack.
+   int nspilled = 0;
+   for (int i = 0; i < n; i++)
+      if (!vars[i]->reg)
+         vars[nspilled++] = vars[i];
+   n = nspilled;
+   qsort(vars, n, sizeof(Obj *), by_first_use);
+   // Linear scan: `active` holds the locals currently occupying a slot.
+   Obj **active = calloc(nvars, sizeof(Obj *));
+   int nactive = 0;
+   Stack free_slots = {};
+   int size = 0;
+
+   for (int i = 0; i < n; i++) {
+      for (int j = 0; j < nactive && opt_level > 0;) {
+         if (active[j]->last_use < vars[i]->first_use) {
+            stack_push(&free_slots, active[j]);
+            active[j] = active[--nactive];
+         } else {
+            j++;
+         }
+      }
+
+      if (free_slots.len) {
+         vars[i]->offset = ((Obj *)stack_pop(&free_slots))->offset;
+      } else {
+         vars[i]->offset = size;
+         size += 8;
+      }
+      active[nactive++] = vars[i];
+   }
+
+   // main makes no calls, so if the locals and every temporary pushed
+   // below them fit in the 128-byte red zone there is no need to move
+   // %rsp at all. Otherwise reserve the locals with a single sub.
+   if (opt_level > 0 && size + max_depth * 8 <= 128) {
+      for (int i = 0; i < n; i++)
+         vars[i]->offset -= size + max_depth * 8;
+      prog->stack_size = 0;
+   } else {
+      prog->stack_size = size;
+   }
+
+   free(vars);
+   free(active);
+   free(free_slots.data);
+} //;;;
+
+// With -finstrument-stmts each statement bumps its own counter in .bss.
+// A destructor registered through .fini_array writes the counters to
+// PROFILE_FILE at exit, keyed by the statement's offset in the source.
+static void gen_profile_runtime(Function *prog, int nstmts) { //:::
+   fprintf(out, "   .bss\n");
+   fprintf(out, "   .p2align 3\n");
+   fprintf(out, ".L.prof.counters:\n");
+   fprintf(out, "   .zero %d\n", nstmts * 8);
+
+   fprintf(out, "   .section .rodata\n");
+   fprintf(out, "   .p2align 3\n");
+   fprintf(out, ".L.prof.offsets:\n");
+   for (Node *n = prog->body; n; n = n->next)
+      fprintf(out, "   .quad %d\n", source_offset(n->tok->loc));
+   fprintf(out, ".L.prof.path:\n");
+   fprintf(out, "   .string \"%s\"\n", PROFILE_FILE);
+   fprintf(out, ".L.prof.mode:\n");
+   fprintf(out, "   .string \"w\"\n");
+   fprintf(out, ".L.prof.header:\n");
+   fprintf(out, "   .string \"# 9cc statement profile: <source offset> <count>\\n\"\n");
+   fprintf(out, ".L.prof.fmt:\n");
+   fprintf(out, "   .string \"%%ld %%ld\\n\"\n");
+
+   fprintf(out, "   .text\n");
+   fprintf(out, ".L.prof.dump:\n");
+   // Three pushes realign the stack to 16 bytes for the calls below.
+   fprintf(out, "   push %%rbx\n");
+   fprintf(out, "   push %%r12\n");
+   fprintf(out, "   push %%r13\n");
+   fprintf(out, "   lea .L.prof.path(%%rip), %%rdi\n");
+   fprintf(out, "   lea .L.prof.mode(%%rip), %%rsi\n");
+   fprintf(out, "   call fopen@PLT\n");
+   fprintf(out, "   test %%rax, %%rax\n");
+   fprintf(out, "   jz .L.prof.done\n");
+   fprintf(out, "   mov %%rax, %%rbx\n");
+   fprintf(out, "   mov %%rbx, %%rdi\n");
+   fprintf(out, "   lea .L.prof.header(%%rip), %%rsi\n");
+   fprintf(out, "   xor %%eax, %%eax\n");
+   fprintf(out, "   call fprintf@PLT\n");
+   fprintf(out, "   xor %%r12d, %%r12d\n");
+   fprintf(out, ".L.prof.loop:\n");
+   fprintf(out, "   cmp $%d, %%r12\n", nstmts);
+   fprintf(out, "   je .L.prof.close\n");
+   fprintf(out, "   mov %%rbx, %%rdi\n");
+   fprintf(out, "   lea .L.prof.fmt(%%rip), %%rsi\n");
+   fprintf(out, "   lea .L.prof.offsets(%%rip), %%r13\n");
+   fprintf(out, "   mov (%%r13,%%r12,8), %%rdx\n");
+   fprintf(out, "   lea .L.prof.counters(%%rip), %%r13\n");
+   fprintf(out, "   mov (%%r13,%%r12,8), %%rcx\n");
+   fprintf(out, "   xor %%eax, %%eax\n");
+   fprintf(out, "   call fprintf@PLT\n");
+   fprintf(out, "   inc %%r12\n");
+   fprintf(out, "   jmp .L.prof.loop\n");
+   fprintf(out, ".L.prof.close:\n");
+   fprintf(out, "   mov %%rbx, %%rdi\n");
+   fprintf(out, "   call fclose@PLT\n");
+   fprintf(out, ".L.prof.done:\n");
+   fprintf(out, "   pop %%r13\n");
+   fprintf(out, "   pop %%r12\n");
+   fprintf(out, "   pop %%rbx\n");
+   fprintf(out, "   ret\n");
+
+   fprintf(out, "   .section .fini_array,\"aw\"\n");
+   fprintf(out, "   .p2align 3\n");
+   fprintf(out, "   .quad .L.prof.dump\n");
+} //;;;
+
+// Ranges of locals are forgotten every MIN_CHUNK_STMTS statements, where
+// a parallel chunk may begin, so every thread count gives the same code.
+#define MIN_CHUNK_STMTS 512
+
+static void gen_stmts(Function *prog, Node **stmts, int begin, int end) { //:::
+   for (int i = begin; i < end; i++) {
+      if (i % MIN_CHUNK_STMTS == 0)
+         forget_lvar_ranges();
+      gen_stmt(prog, stmts[i], i);
       assert(depth == 0);
    }
-   
-   printf(".L.return:\n");
-   printf("   mov %%rbp, %%rsp\n");
-   printf("   pop %%rbp\n");
-   printf("   ret\n");
 } //;;;
 
+// With -fpipeline, once locations are assigned every statement can be
+// generated independently: each starts and ends with nothing pushed. The
+// statements are split into contiguous chunks, one per thread, each
+// written to its own buffer, and the buffers are joined in order.
+#define MAX_THREADS 16
+
+typedef struct Chunk Chunk;
+struct Chunk {
+   Function *prog;
+   Node **stmts;
+   int begin;
+   int end;
+   char *buf;
+   size_t len;
+};
+
+static void *gen_chunk(void *arg) { //:::
+   Chunk *c = arg;
+   out = open_memstream(&c->buf, &c->len);
+   gen_stmts(c->prog, c->stmts, c->begin, c->end);
+   fclose(out);
+   return NULL;
+} //;;;
+
+static void gen_stmts_parallel(Function *prog, Node **stmts, int nstmts) { //:::
+   int nthreads = opt_codegen_threads ? opt_codegen_threads : sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads > MAX_THREADS)
+      nthreads = MAX_THREADS;
+   if (nthreads > nstmts / MIN_CHUNK_STMTS)
+      nthreads = nstmts / MIN_CHUNK_STMTS;
+   if (nthreads <= 1) {
+      gen_stmts(prog, stmts, 0, nstmts);
+      return;
+   }
+
+   Chunk chunks[MAX_THREADS];
+   pthread_t threads[MAX_THREADS];
+   // Chunks begin on a multiple of MIN_CHUNK_STMTS; see gen_stmts().
+   int begin[MAX_THREADS + 1];
+   for (int i = 0; i < nthreads; i++)
+      begin[i] = (long)nstmts * i / nthreads / MIN_CHUNK_STMTS * MIN_CHUNK_STMTS;
+   begin[nthreads] = nstmts;
+
+   for (int i = 0; i < nthreads; i++) {
+      chunks[i] = (Chunk){prog, stmts, begin[i], begin[i + 1]};
+      pthread_create(&threads[i], NULL, gen_chunk, &chunks[i]);
+   }
+
+   for (int i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+      fwrite(chunks[i].buf, 1, chunks[i].len, out);
+      free(chunks[i].buf);
+   }
+} //;;;
+
+void codegen(Function *prog) {
+   out = stdout;
+   assign_lvar_locations(prog);
+
+   if (opt_g)
+      fprintf(out, "   .file 1 \"%s\"\n", base_file);
+   fprintf(out, "   .globl main\n");
+   fprintf(out, "   .type main, @function\n");
+   fprintf(out, "main:\n");
+   cfi(".cfi_startproc");
 
+   // Attribute the prologue to the first statement.
+   if (prog->body)
+      gen_loc(prog->body->tok);
+
+   // Prologue. There is no frame pointer: locals are addressed from %rsp.
+   for (int i = 0; i < num_saved_regs; i++) {
+      fprintf(out, "   push %s\n", saved_regs[i]);
+      cfi(".cfi_adjust_cfa_offset 8");
+      cfi(".cfi_rel_offset %s, 0", saved_regs[i]);
+   }
+   if (prog->stack_size) {
+      fprintf(out, "   sub $%d, %%rsp\n", prog->stack_size);
+      cfi(".cfi_adjust_cfa_offset %d", prog->stack_size);
+   }
+
+   int nstmts = 0;
+   for (Node *n = prog->body; n; n = n->next)
+      nstmts++;
+
+   Node **stmts = calloc(nstmts, sizeof(Node *));
+   int i = 0;
+   for (Node *n = prog->body; n; n = n->next)
+      stmts[i++] = n;
+
+   if (opt_pipeline && nstmts >= 2 * MIN_CHUNK_STMTS)
+      gen_stmts_parallel(prog, stmts, nstmts);
+   else
+      gen_stmts(prog, stmts, 0, nstmts);
+
+   if (!nstmts || stmts[nstmts - 1]->kind != ND_RETURN)
+      gen_epilogue(prog);
+   free(stmts);
+
+   cfi(".cfi_endproc");
+   fprintf(out, "   .size main, .-main\n");
+
+   if (opt_instrument_stmts)
+      gen_profile_runtime(prog, nstmts);
+} //;;;
@@ -0,0 +1,46 @@
+#include "9cc.h"
+
+void stack_push(Stack *s, void *elem) { //::: Push `elem`, growing the buffer as needed.
+   if (s->len == s->capacity) {
+      s->capacity = s->capacity ? s->capacity * 2 : 16;
+      s->data = realloc(s->data, sizeof(void *) * s->capacity);
+   }
+   s->data[s->len++] = elem;
+} //;;;
+void *stack_pop(Stack *s) { //:::
+   assert(s->len > 0);
+   return s->data[--s->len];
+} //;;;
+void *stack_peek(Stack *s) { //::: Returns the top element, or NULL if `s` is empty.
+   return s->len ? s->data[s->len - 1] : NULL;
+} //;;;
+
+void queue_init(Queue *q, int capacity) { //::: `capacity` must be a power of two.
+   assert((capacity & (capacity - 1)) == 0);
+   q->data = calloc(capacity, sizeof(void *));
+   q->capacity = capacity;
+   atomic_init(&q->head, 0);
+   atomic_init(&q->tail, 0);
+   q->cached_head = q->cached_tail = 0;
+} //;;;
+void queue_push(Queue *q, void *elem) { //::: Producer side. Waits while the queue is full.
+   size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+   while (tail - q->cached_head == q->capacity) {
+      q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+      if (tail - q->cached_head == q->capacity)
+         sched_yield();
+   }
+   q->data[tail & (q->capacity - 1)] = elem;
+   atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+} //;;;
+void *queue_pop(Queue *q) { //::: Consumer side. Waits while the queue is empty.
+   size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+   while (head == q->cached_tail) {
+      q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+      if (head == q->cached_tail)
+         sched_yield();
+   }
+   void *elem = q->data[head & (q->capacity - 1)];
+   atomic_store_explicit(&q->head, head + 1, memory_order_release);
+   return elem;
+} //;;;
@@ -1,16 +1,142 @@
 #include "9cc.h"
 
+char *base_file;
+int opt_level = 1;
+bool opt_hash_cons;
+bool opt_g;
+bool opt_instrument_stmts;
+bool opt_pipeline;
+int opt_codegen_threads;
+char *opt_opaque;
+
+static Queue token_queue;
+
+static void usage(char *argv0) { //:::
+   error("usage: %s [-O0|-O] [-g] [-fhash-cons] [-finstrument-stmts] [-fpipeline[=<threads>]] [-fprofile-use=<file>] [-fsuperopt=<file>] [-fopaque=<var>,...] <file>", argv0);
+} //;;;
+
+static char *read_file(char *path) { //::: Returns the contents of a given file, or stdin if `path` is "-".
+   FILE *fp;
+
+   if (strcmp(path, "-") == 0) {
+      fp = stdin;
+   } else {
+      fp = fopen(path, "r");
+      if (!fp)
+         error("cannot open %s: %s", path, strerror(errno));
+   }
+
+   char *buf;
+   size_t buflen;
+   FILE *out = open_memstream(&buf, &buflen);
+
+   // Read the entire file.
+   for (;;) {
+      char buf2[4096];
+      int n = fread(buf2, 1, sizeof(buf2), fp);
+      if (n == 0)
+         break;
+      fwrite(buf2, 1, n, out);
+   }
+
+   if (fp != stdin)
+      fclose(fp);
+
+   fflush(out);
+   fputc('\0', out);
+   fclose(out);
+   return buf;
+} //;;;
+
+static void *tokenize_thread(void *input) { //:::
+   tokenize_to_queue(base_file, input, &token_queue);
+   return NULL;
+} //;;;
+
 int main(int argc, char **argv) {
-   if (argc != 2) {
-      error("%s: invalid number of arguments", argv[0]);
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-O0")) {
+         opt_level = 0;
+         continue;
+      }
+
+      if (!strcmp(argv[i], "-O") || !strcmp(argv[i], "-O1")) {
+         opt_level = 1;
+         continue;
+      }
+
+      if (!strcmp(argv[i], "-fhash-cons")) {
+         opt_hash_cons = true;
+         continue;
+      }
+
+      if (!strcmp(argv[i], "-g")) {
+         opt_g = true;
+         continue;
+      }
+
+      if (!strcmp(argv[i], "-finstrument-stmts")) {
+         opt_instrument_stmts = true;
+         continue;
+      }
+
+      if (!strcmp(argv[i], "-fpipeline")) {
+         opt_pipeline = true;
+         continue;
+      }
+
+      if (!strncmp(argv[i], "-fpipeline=", 11)) {
+         opt_pipeline = true;
+         opt_codegen_threads = atoi(argv[i] + 11);
+         if (opt_codegen_threads < 1)
+            error("invalid thread count: %s", argv[i]);
+         continue;
+      }
+
+      if (!strncmp(argv[i], "-fprofile-use=", 14)) {
+         load_profile(argv[i] + 14);
+         continue;
+      }
+
+      if (!strncmp(argv[i], "-fsuperopt=", 11)) {
+         load_superopt_rules(argv[i] + 11);
+         continue;
+      }
+
+      if (!strncmp(argv[i], "-fopaque=", 9)) {
+         opt_opaque = argv[i] + 9;
+         continue;
+      }
+
+      if (argv[i][0] == '-' && argv[i][1] != '\0')
+         error("unknown argument: %s", argv[i]);
+      if (base_file)
+         usage(argv[0]);
+      base_file = argv[i];
+   }
+
+   if (!base_file)
+      usage(argv[0]);
+
+   char *input = read_file(base_file);
+   Function *prog;
+
+   if (opt_pipeline) {
+      // The tokenizer runs ahead on its own thread while this one parses.
+      pthread_t thr;
+      queue_init(&token_queue, 4096);
+      pthread_create(&thr, NULL, tokenize_thread, input);
+      prog = parse_queue(&token_queue);
+      pthread_join(thr, NULL);
+   } else {
+      prog = parse(tokenize(base_file, input));
    }
 
-   Token *tok = tokenize(argv[1]);
-   Function *prog = parse(tok);
+   if (error_count)
+      exit(1);
    // Traverse the AST to emit assembly.
    codegen(prog);
 
    return 0;
 
 }
-
@@ -4,12 +4,6 @@ Obj *locals; // All local variable instances created during parsing are accumula
 
 static Node *expr      (Token **rest, Token *tok);
 static Node *expr_stmt (Token **rest, Token *tok);
-static Node *assign    (Token **rest, Token *tok);
-static Node *equality  (Token **rest, Token *tok);
-static Node *relational(Token **rest, Token *tok);
-static Node *add       (Token **rest, Token *tok);
-static Node *mul       (Token **rest, Token *tok);
-static Node *unary     (Token **rest, Token *tok);
 static Node *primary   (Token **rest, Token *tok);
 
 
@@ -21,37 +15,99 @@ static Obj *find_var(Token *tok) { //::: Find a local variable by name.
 } //;;;
 
 
-static Node *new_node  (NodeKind kind) { //:::
+// With -fhash-cons, expression nodes are interned: building a node equal
+// in kind, operands and value to an existing one returns the existing
+// node, so repeated subexpressions form a DAG instead of copies. A shared
+// node keeps the token of its first occurrence.
+// Assignments and statements are never shared, and since children are
+// compared by identity nothing above an assignment is shared either.
+static Node **cons_table;
+static int cons_capacity;
+static int cons_used;
+
+static bool can_share(NodeKind kind) { //:::
+   return kind != ND_ASSIGN && kind != ND_RETURN && kind != ND_EXPR_STMT;
+} //;;;
+static uint64_t hash_node(Node *node) { //::: FNV-1a over the fields that identify a node.
+   uint64_t vals[] = {node->kind, (uintptr_t)node->lhs, (uintptr_t)node->rhs,
+                      (uintptr_t)node->var, (uint64_t)node->val};
+   uint64_t hash = 0xcbf29ce484222325;
+   for (int i = 0; i < sizeof(vals) / sizeof(*vals); i++) {
+      hash ^= vals[i];
+      hash *= 0x100000001b3;
+   }
+   return hash;
+} //;;;
+static bool same_node(Node *a, Node *b) { //:::
+   return a->kind == b->kind && a->lhs == b->lhs && a->rhs == b->rhs &&
+          a->var == b->var && a->val == b->val;
+} //;;;
+static void cons_rehash(void) { //::: Double the table, keeping load under 1/2.
+   Node **old = cons_table;
+   int old_capacity = cons_capacity;
+
+   cons_capacity = cons_capacity ? cons_capacity * 2 : 256;
+   cons_table = calloc(cons_capacity, sizeof(Node *));
+   for (int i = 0; i < old_capacity; i++) {
+      if (!old[i])
+         continue;
+      int j = hash_node(old[i]) & (cons_capacity - 1);
+      while (cons_table[j])
+         j = (j + 1) & (cons_capacity - 1);
+      cons_table[j] = old[i];
+   }
+   free(old);
+} //;;;
+static Node *intern(Node *tmpl) { //::: Returns a node equal to `tmpl`, shared if hash-consing.
+   if (opt_hash_cons && can_share(tmpl->kind)) {
+      if (cons_used * 2 >= cons_capacity)
+         cons_rehash();
+
+      int i = hash_node(tmpl) & (cons_capacity - 1);
+      for (; cons_table[i]; i = (i + 1) & (cons_capacity - 1))
+         if (same_node(cons_table[i], tmpl))
+            return cons_table[i];
+
+      Node *node = calloc(1, sizeof(Node));
+      *node = *tmpl;
+      cons_table[i] = node;
+      cons_used++;
+      return node;
+   }
+
    Node *node = calloc(1, sizeof(Node));
-   node->kind = kind;
+   *node = *tmpl;
    return node;
 } //;;;
-static Node *new_binary(NodeKind kind, Node *lhs, Node *rhs) { //:::
-   Node *node = new_node(kind);
-   node->lhs = lhs;
-   node->rhs = rhs;
-   return node;
+
+static Node *new_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) { //:::
+   return intern(&(Node){.kind = kind, .lhs = lhs, .rhs = rhs, .tok = tok});
 } //;;;
-static Node *new_unary (NodeKind kind, Node *expr) { //:::
-   Node *node = new_node(kind);
-   node->lhs = expr;
-   return node;
+static Node *new_unary (NodeKind kind, Node *expr, Token *tok) { //:::
+   return intern(&(Node){.kind = kind, .lhs = expr, .tok = tok});
 } //;;;
-static Node *new_num   (int val) { //:::
-   Node *node = new_node(ND_NUM);
-   node->val = val;
-   return node;
+static Node *new_num   (int val, Token *tok) { //:::
+   return intern(&(Node){.kind = ND_NUM, .val = val, .tok = tok});
 } //;;;
 
-static Node *new_var_node(Obj *var) { //:::
-   Node *node = new_node(ND_VAR);
-   node->var = var;
-   return node;
+static Node *new_var_node(Obj *var, Token *tok) { //:::
+   return intern(&(Node){.kind = ND_VAR, .var = var, .tok = tok});
+} //;;;
+
+static bool opaque(char *name) { //::: Whether -fopaque lists `name`.
+   int len = strlen(name);
+   for (char *p = opt_opaque; p; p = strchr(p, ',')) {
+      p += *p == ',';
+      if (!strncmp(p, name, len) && (p[len] == ',' || p[len] == '\0'))
+         return true;
+   }
+   return false;
 } //;;;
 
 static Obj *new_lvar(char *name) { //:::
   Obj *var = calloc(1, sizeof(Obj));
   var->name = name;
+  var->opaque = opaque(name);
   var->next = locals;
   locals = var;
   return var;
@@ -61,142 +117,157 @@ static Obj *new_lvar(char *name) { //:::
 //      | expr-stmt
 static Node *stmt      (Token **rest, Token *tok) {
    if (equal(tok, "return")) {
-      Node *node = new_unary(ND_RETURN, expr(&tok, tok->next));
+      // expr() advances `tok`, so keep the statement's first token.
+      Token *start = tok;
+      Node *node = new_unary(ND_RETURN, expr(&tok, tok->next), start);
       *rest = skip(tok, ";");
       return node;
    }
    return expr_stmt(rest, tok);
 } //;;;
 static Node *expr_stmt (Token **rest, Token *tok) {  //::: expr-stmt = expr ";"
-   Node *node = new_unary(ND_EXPR_STMT, expr(&tok, tok));
+   Token *start = tok;
+   Node *node = new_unary(ND_EXPR_STMT, expr(&tok, tok), start);
    *rest = skip(tok, ";");
    return node;
 } //;;;
 
-static Node *expr      (Token **rest, Token *tok) {  //::: expr = assign
-   return assign(rest, tok);
+// expr = ("(" | "+" | "-")* primary ((")")* binop ("(" | "+" | "-")* primary)*
+//
+// Expressions are parsed by precedence climbing over the `binops` table
+// with explicit operand and operator stacks instead of one recursive call
+// per precedence level, so nesting depth is limited only by memory.
+
+typedef struct BinOp BinOp;
+struct BinOp {
+   char *op;
+   NodeKind kind;
+   int prec;    // Higher binds tighter; 0 marks an open "("
+   bool swap;   // `a > b` is parsed as `b < a`
+};
+
+static BinOp binops[] = {
+   {"=",  ND_ASSIGN, 1},
+   {"==", ND_EQ,     2},
+   {"!=", ND_NE,     2},
+   {"<",  ND_LT,     3},
+   {"<=", ND_LE,     3},
+   {">",  ND_LT,     3, true},
+   {">=", ND_LE,     3, true},
+   {"+",  ND_ADD,    4},
+   {"-",  ND_SUB,    4},
+   {"*",  ND_MUL,    5},
+   {"/",  ND_DIV,    5},
+};
+
+static BinOp paren_op = {"(", 0, 0};
+static BinOp neg_op   = {"-", ND_NEG, 6};
+
+// expr() never recurses, so the stacks are shared between calls.
+// `oper_toks` holds the token of each entry of `opers`.
+static Stack operands;
+static Stack opers;
+static Stack oper_toks;
+
+static BinOp *find_binop(Token *tok) { //:::
+   if (tok->kind != TK_PUNCT)
+      return NULL;
+   for (int i = 0; i < sizeof(binops) / sizeof(*binops); i++)
+      if (equal(tok, binops[i].op))
+         return &binops[i];
+   return NULL;
 } //;;;
 
-static Node *assign    (Token **rest, Token *tok) {  //::: assign = equality ("=" assign)?
-   Node *node = equality(&tok, tok);
-   if (equal(tok, "="))
-      node = new_binary(ND_ASSIGN, node, assign(&tok, tok->next));
-   *rest = tok;
-   return node;
+static void push_oper(BinOp *op, Token *tok) { //:::
+   stack_push(&opers, op);
+   stack_push(&oper_toks, tok);
 } //;;;
 
-static Node *equality  (Token **rest, Token *tok) {  //::: equality = relational ("==" relational | "!=" relational)*
-   Node *node = relational(&tok, tok);
-
+static void reduce(int min_prec) { //::: Fold operators binding at least as tight as `min_prec` into nodes.
    for (;;) {
-      if (equal(tok, "==")) {
-         node = new_binary(ND_EQ, node, relational(&tok, tok->next));
-         continue;
-      }
-
-      if (equal(tok, "!=")) {
-         node = new_binary(ND_NE, node, relational(&tok, tok->next));
+      BinOp *op = stack_peek(&opers);
+      if (!op || op->prec < min_prec || op == &paren_op)
+         return;
+      stack_pop(&opers);
+      Token *tok = stack_pop(&oper_toks);
+
+      if (op == &neg_op) {
+         stack_push(&operands, new_unary(ND_NEG, stack_pop(&operands), tok));
          continue;
       }
 
-      *rest = tok;
-      return node;
+      Node *rhs = stack_pop(&operands);
+      Node *lhs = stack_pop(&operands);
+      // Report at the "=": a hash-consed lhs carries the token of its
+      // first occurrence, which may be on another line.
+      if (op->kind == ND_ASSIGN && lhs->kind != ND_VAR)
+         error_tok(tok, "not an lvalue");
+
+      if (op->swap)
+         stack_push(&operands, new_binary(op->kind, rhs, lhs, tok));
+      else
+         stack_push(&operands, new_binary(op->kind, lhs, rhs, tok));
    }
 } //;;;
 
-static Node *relational(Token **rest, Token *tok) {  //::: relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-   Node *node = add(&tok, tok);
+static Node *expr      (Token **rest, Token *tok) { //:::
+   int parens = 0;
+   operands.len = opers.len = oper_toks.len = 0;
 
    for (;;) {
-      if (equal(tok, "<")) {
-         node = new_binary(ND_LT, node, add(&tok, tok->next));
-         continue;
-      }
-
-      if (equal(tok, "<=")) {
-         node = new_binary(ND_LE, node, add(&tok, tok->next));
-         continue;
-      }
-
-      if (equal(tok, ">")) {
-         node = new_binary(ND_LT, add(&tok, tok->next), node);
-         continue;
-      }
-
-      if (equal(tok, ">=")) {
-         node = new_binary(ND_LE, add(&tok, tok->next), node);
-         continue;
+      // Prefix operators and open parentheses, then an operand.
+      for (;;) {
+         if (equal(tok, "(")) {
+            push_oper(&paren_op, tok);
+            parens++;
+         } else if (equal(tok, "-")) {
+            push_oper(&neg_op, tok);
+         } else if (!equal(tok, "+")) {
+            break;
+         }
+         tok = tok->next;
       }
-
-      *rest = tok;
-      return node;
-   }
-} //;;;
-static Node *add       (Token **rest, Token *tok) {  //::: add = mul ("+" mul | "-" mul)*
-  Node *node = mul(&tok, tok);
-
-  for (;;) {
-    if (equal(tok, "+")) {
-      node = new_binary(ND_ADD, node, mul(&tok, tok->next));
-      continue;
-    }
-
-    if (equal(tok, "-")) {
-      node = new_binary(ND_SUB, node, mul(&tok, tok->next));
-      continue;
-    }
-
-    *rest = tok;
-    return node;
-  }
-} //;;;
-
-
-static Node *mul       (Token **rest, Token *tok) {  //::: mul = unary ("*" unary | "/" unary)*
-   Node *node = unary(&tok, tok);
-
-   for (;;) {
-      if (equal(tok, "*")) {
-         node = new_binary(ND_MUL, node, unary(&tok, tok->next));
-         continue;
+      stack_push(&operands, primary(&tok, tok));
+
+      while (parens > 0 && equal(tok, ")")) {
+         reduce(1);
+         stack_pop(&opers);
+         stack_pop(&oper_toks);
+         parens--;
+         tok = tok->next;
       }
 
-      if (equal(tok, "/")) {
-         node = new_binary(ND_DIV, node, unary(&tok, tok->next));
-         continue;
-      }
+      BinOp *op = find_binop(tok);
+      if (!op)
+         break;
 
-      *rest = tok;
-      return node;
+      // "=" is right-associative; everything else is left-associative.
+      reduce(op->kind == ND_ASSIGN ? op->prec + 1 : op->prec);
+      push_oper(op, tok);
+      tok = tok->next;
    }
-} //;;;
-static Node *unary     (Token **rest, Token *tok) {  //::: unary = ("+" | "-") unary    |    primary
-   if (equal(tok, "+"))
-      return unary(rest, tok->next);
 
-   if (equal(tok, "-"))
-      return new_unary(ND_NEG, unary(rest, tok->next));
+   if (parens > 0)
+      error_tok(tok, "expected ')'");
 
-   return primary(rest, tok);
+   reduce(1);
+   assert(operands.len == 1 && opers.len == 0);
+   *rest = tok;
+   return stack_pop(&operands);
 } //;;;
-static Node *primary   (Token **rest, Token *tok) {  //::: primary = "(" expr ")" | ident | num
-   if (equal(tok, "(")) {
-      Node *node = expr(&tok, tok->next);
-      *rest = skip(tok, ")");
-      return node;
-   }
 
+static Node *primary   (Token **rest, Token *tok) {  //::: primary = ident | num
    if (tok->kind == TK_IDENT) {
       Obj *var = find_var(tok);
       if (!var) {
          var = new_lvar(strndup(tok->loc, tok->len));
       }
       *rest = tok->next;
-      return new_var_node(var);
+      return new_var_node(var, tok);
    }
 
    if (tok->kind == TK_NUM) {
-      Node *node = new_num(tok->val);
+      Node *node = new_num(tok->val, tok);
       *rest = tok->next;
       return node;
    }
@@ -205,12 +276,56 @@ static Node *primary   (Token **rest, Token *tok) {  //::: primary = "(" expr ")
 
 
 
-Function *parse(Token *tok) { //:::
+static Token *sync(Token *tok) { //::: Skip past the next ";" after a syntax error.
+   while (tok->kind != TK_EOF && !equal(tok, ";"))
+      tok = tok->next;
+   return tok->kind == TK_EOF ? tok : tok->next;
+} //;;;
+
+// With -fpipeline tokens arrive through a queue from the tokenizer
+// thread. They are linked into a list here one statement at a time, up
+// to and including the next ";" (or EOF), which is all stmt() looks at.
+static Queue *token_queue;
+static Token *queue_tail;
+
+static Token *pull_stmt(void) { //::: Link the next statement's tokens and return its first.
+   Token *first = NULL;
+   for (;;) {
+      Token *tok = queue_pop(token_queue);
+      queue_tail = queue_tail->next = tok;
+      if (!first)
+         first = tok;
+      if (tok->kind == TK_EOF || equal(tok, ";"))
+         return first;
+   }
+} //;;;
+
+static Function *parse_program(Token *tok) { //:::
   Node head = {};
   Node *cur = &head;
 
-  while (tok->kind != TK_EOF)
+  // A syntax error abandons the current statement and parsing resumes
+  // after its ";", so a single run reports every broken statement.
+  jmp_buf env;
+  error_recover = &env;
+
+  for (;;) {
+    // A statement ends where the pulled tokens do, so `tok` runs off the
+    // end of the list exactly when the next statement must be pulled.
+    if (!tok)
+      tok = pull_stmt();
+    if (tok->kind == TK_EOF)
+      break;
+
+    Token *start = tok;
+    if (setjmp(env)) {
+      tok = sync(start);
+      continue;
+    }
     cur = cur->next = stmt(&tok, tok);
+  }
+
+  error_recover = NULL;
 
   Function *prog = calloc(1, sizeof(Function));
   prog->body = head.next;
@@ -218,4 +333,13 @@ Function *parse(Token *tok) { //:::
   return prog;
 } //;;;
 
+Function *parse(Token *tok) { //:::
+  return parse_program(tok);
+} //;;;
 
+Function *parse_queue(Queue *q) { //::: Parse tokens as they come out of `q`.
+  Token head = {};
+  token_queue = q;
+  queue_tail = &head;
+  return parse_program(NULL);
+} //;;;
@@ -0,0 +1,207 @@
+#include "9cc.h"
+
+// Rules found by tools/superopt map a small expression pattern to the
+// shortest instruction sequence computing it. A pattern is keyed by its
+// prefix form with variables renamed in order of first appearance, so
+// `(p+q)*(p-q)` and `(a+b)*(a-b)` both become "(* (+ x0 x1) (- x0 x1))".
+//
+// A sequence reads x0 from %rdi and x1 from %rdx and leaves its result in
+// %rax; it may clobber all three.
+
+typedef struct Rule Rule;
+struct Rule {
+   char *key;
+   char *insns; // One instruction per line
+   int len;     // Number of instructions
+};
+
+static Rule *rules;
+static int rules_capacity;
+static int rules_used;
+
+static uint64_t hash_string(char *s) { //::: FNV-1a
+   uint64_t hash = 0xcbf29ce484222325;
+   for (; *s; s++) {
+      hash ^= (unsigned char)*s;
+      hash *= 0x100000001b3;
+   }
+   return hash;
+} //;;;
+
+static void put_rule(Rule rule) { //:::
+   if (rules_used * 2 >= rules_capacity) {
+      Rule *old = rules;
+      int old_capacity = rules_capacity;
+      rules_capacity = rules_capacity ? rules_capacity * 2 : 64;
+      rules = calloc(rules_capacity, sizeof(Rule));
+      rules_used = 0;
+      for (int i = 0; i < old_capacity; i++)
+         if (old[i].key)
+            put_rule(old[i]);
+      free(old);
+   }
+
+   int i = hash_string(rule.key) & (rules_capacity - 1);
+   for (; rules[i].key; i = (i + 1) & (rules_capacity - 1)) {
+      if (!strcmp(rules[i].key, rule.key)) {
+         rules[i] = rule;
+         return;
+      }
+   }
+   rules[i] = rule;
+   rules_used++;
+} //;;;
+
+static Rule *find_rule(char *key) { //:::
+   if (!rules)
+      return NULL;
+   int i = hash_string(key) & (rules_capacity - 1);
+   for (; rules[i].key; i = (i + 1) & (rules_capacity - 1))
+      if (!strcmp(rules[i].key, key))
+         return &rules[i];
+   return NULL;
+} //;;;
+
+// Read a rule database: one rule per line, the key and the instructions
+// separated by a tab and the instructions by "; ". '#' starts a comment.
+void load_superopt_rules(char *path) { //:::
+   FILE *fp = fopen(path, "r");
+   if (!fp)
+      error("cannot open %s: %s", path, strerror(errno));
+
+   char *line = NULL;
+   size_t cap = 0;
+   while (getline(&line, &cap, fp) != -1) {
+      line[strcspn(line, "\n")] = '\0';
+      char *tab = strchr(line, '\t');
+      if (line[0] == '#' || !tab)
+         continue;
+
+      Rule rule = {strndup(line, tab - line), calloc(1, strlen(tab) + 1), 1};
+      char *out = rule.insns;
+      for (char *p = tab + 1; *p; p++) {
+         if (p[0] == ';' && p[1] == ' ') {
+            *out++ = '\n';
+            rule.len++;
+            p++;
+            continue;
+         }
+         *out++ = *p;
+      }
+      put_rule(rule);
+   }
+   free(line);
+   fclose(fp);
+} //;;;
+
+bool have_superopt_rules(void) { //:::
+   return rules_used > 0;
+} //;;;
+
+static char *node_op(NodeKind kind) { //::: Key spelling of an operator, or NULL if patterns may not contain it.
+   switch (kind) {
+   case ND_ADD: return "+";
+   case ND_SUB: return "-";
+   case ND_MUL: return "*";
+   case ND_EQ:  return "==";
+   case ND_NE:  return "!=";
+   case ND_LT:  return "<";
+   case ND_LE:  return "<=";
+   case ND_NEG: return "neg";
+   }
+   return NULL;
+} //;;;
+
+static bool write_key(FILE *out, Node *node, Obj **inputs, int *ninputs, int *budget) { //:::
+   if (--*budget < 0)
+      return false;
+
+   if (node->kind == ND_NUM) {
+      fprintf(out, "%d", node->val);
+      return true;
+   }
+
+   if (node->kind == ND_VAR) {
+      int i = 0;
+      while (i < *ninputs && inputs[i] != node->var)
+         i++;
+      if (i == *ninputs) {
+         if (i == SUPEROPT_MAX_INPUTS)
+            return false;
+         inputs[(*ninputs)++] = node->var;
+      }
+      fprintf(out, "x%d", i);
+      return true;
+   }
+
+   char *op = node_op(node->kind);
+   if (!op)
+      return false;
+
+   fprintf(out, "(%s ", op);
+   if (!write_key(out, node->lhs, inputs, ninputs, budget))
+      return false;
+   if (node->rhs) {
+      fprintf(out, " ");
+      if (!write_key(out, node->rhs, inputs, ninputs, budget))
+         return false;
+   }
+   fprintf(out, ")");
+   return true;
+} //;;;
+
+// Returns the key of the pattern rooted at `node`, storing its variables
+// in `inputs` in x0, x1 order, or NULL if the subtree is too large, has
+// too many variables or contains an operator patterns do not cover.
+// The budget on nodes also bounds the recursion.
+char *superopt_key(Node *node, Obj **inputs, int *ninputs) { //:::
+   char *buf;
+   size_t len;
+   FILE *out = open_memstream(&buf, &len);
+
+   int budget = SUPEROPT_MAX_NODES;
+   *ninputs = 0;
+   bool ok = write_key(out, node, inputs, ninputs, &budget);
+   fclose(out);
+
+   if (!ok) {
+      free(buf);
+      return NULL;
+   }
+   return buf;
+} //;;;
+
+// Instructions the stack-machine codegen spends on `node`, as an upper
+// bound to beat. Only called on keyed patterns, which are small.
+static int default_cost(Node *node) { //:::
+   switch (node->kind) {
+   case ND_NUM:
+   case ND_VAR:
+      return 1;
+   case ND_NEG:
+      return 1 + default_cost(node->lhs);
+   case ND_EQ:
+   case ND_NE:
+   case ND_LT:
+   case ND_LE:
+      return 5 + default_cost(node->lhs) + default_cost(node->rhs);
+   }
+   return 3 + default_cost(node->lhs) + default_cost(node->rhs);
+} //;;;
+
+// Returns the instructions for `node` if a rule matches and beats the
+// default code, with the pattern's variables stored in `inputs`.
+char *superopt_lookup(Node *node, Obj **inputs, int *ninputs) { //:::
+   if (node->kind == ND_NUM || node->kind == ND_VAR)
+      return NULL;
+
+   char *key = superopt_key(node, inputs, ninputs);
+   if (!key)
+      return NULL;
+
+   Rule *rule = find_rule(key);
+   free(key);
+   if (!rule || rule->len + *ninputs >= default_cost(node))
+      return NULL;
+   return rule->insns;
+} //;;;
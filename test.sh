@@ -3,7 +3,7 @@ assert() {
    expected="$1"
    input="$2"
 
-   ./9cc "$input" >tmp.s || exit
+   echo "$input" | ./9cc "${@:3}" - >tmp.s || exit
    gcc -static -o tmp tmp.s
    ./tmp
    actual="$?"
@@ -55,8 +55,115 @@ assert 6 'a=b=3; return a+b;'
 assert 3 'foo=3; return foo;'
 assert 8 'foo123=3; bar=5; return foo123+bar;'
 
+assert 9 'a=b=c=3; return a+b+c;'
+assert 10 'return -(1-(2-(3-(4-(5-(6-7))))))+3*3*2-(((4)));'
+assert 1 'return 1<2==2>1;'
+
+deep=$(printf '(%.0s' {1..50000})7$(printf ')%.0s' {1..50000})
+assert 7 "return $deep;" >/dev/null && echo 'deep parens => 7'
+chain=$(printf 'a=%.0s' {1..50000})
+assert 5 "${chain}5; return a;" >/dev/null && echo 'long assign chain => 5'
+
+assert 10 'a=1; b=a+2; c=b*3; d=c-1; e=d+a; return e+b+d-c-a;'
+assert 136 'a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8;i=9;j=10;k=11;l=12;m=13;n=14;o=15;p=16; return a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p;'
+assert 16 'a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8;i=9;j=10;k=11;l=12;m=13;n=14;o=15;p=16; return (a+(b+(c+(d+e))))+(p-o);'
+
+assert 14 'a=3; b=4; c=(a+b)*(a+b)-(a+b)*(a+b)+(a+b); return c+(a+b);' -fhash-cons
+assert 6 'a=1; b=a+a; a=b+a; c=a+a; return c-(a+a)+(a+a)-b+a-1;' -fhash-cons
+assert 5 'x=(1+2)*(1+2); y=(1+2)*(1+2)-x; return y+x-(1+2)-(1);' -fhash-cons
+
+assert 6 'a=1; b=2;
+c=a+b; return c*2;' -g
+assert 5 'x=(1+2)*(1+2); y=(1+2)*(1+2)-x; return y+x-(1+2)-(1);' -g -fhash-cons
+# Eight overlapping locals: all in registers, the last two in callee-saved
+# ones that must be saved in the prologue and restored before ret.
+prog='a=1; b=2; c=3; d=4; e=5; f=6; g=7; h=8; return a+b*c-d+e*f-g+h;'
+assert 34 "$prog"
+echo "$prog" | ./9cc - > tmp.s
+for reg in rbx r12; do
+   [ "$(grep -c "^   push %$reg$" tmp.s)" = 1 ] && [ "$(grep -c "^   pop %$reg$" tmp.s)" = 1 ] ||
+      { echo "%$reg not saved and restored"; exit 1; }
+done
+! grep -q '(%rsp)' tmp.s || { echo "a local was left on the stack"; exit 1; }
+echo "8 locals => in registers, %rbx and %r12 saved"
+
+# A statement is located at its first token, not its ';'.
+printf 'a=1;\nreturn\na;\n' | ./9cc -g - | grep -q '^   \.loc 1 2 1$' ||
+   { echo "return not located at line 2"; exit 1; }
+
+# Value ranges: 32-bit and unsigned division, decided comparisons, and
+# results that must stay 64-bit.
+assert 7 'a=-7; b=2; return a/b+10;'
+assert 14 'a=100; b=7; return a/b;'
+assert 5 'a=-2147483647-1; b=-1; return a/b-65536*32768+5;'
+assert 151 'a=65536*65536; b=3; return a/b/1000000;'
+assert 2 'a=65536*32768; return a*2/a;'
+assert 0 'a=65536*65536; return (a-1)/65536/65536;'
+assert 1 'a=3; b=5; return (a<b)+(b<a)*2+((a<b)==(b<a))*4;'
+assert 15 'a=-5; return -a*3;'
+assert 2 'a=-1; b=a*a; return (b<a)+(a<b)+(a-b<0)-(0<b*b-2);'
+assert 3 'a=1; a=a+a; b=a*a*a*a; a=-b; return (a<-15)+(a<=-16)+(b==16)+(b!=16);' -fhash-cons
+
+# -fopaque hides assigned values, so the comparison is no longer decided.
+assert 1 'a=3; b=5; return a<b;' -fopaque=b,a
+echo 'a=3; b=5; return a<b;' | ./9cc -fopaque=a,b - | grep -q setl ||
+   { echo "-fopaque values were still assumed"; exit 1; }
+
+# Superoptimiser rules, on locals in registers and on the stack.
+assert 108 'a=7; b=3; return (a+b)*(a-b) + (a>=b)*2 + a*9+b;' -fsuperopt=superopt.rules
+assert 108 'a=7; b=3; return (a+b)*(a-b) + (a>=b)*2 + a*9+b;' -O0 -fsuperopt=superopt.rules
+assert 3 'a=2; b=-5; c=(a<b)+(b<a)*2-(a==b)+(a!=b); return c-a*4+b*8+48;' -fsuperopt=superopt.rules
+assert 9 'a=3; b=3; return (a<=b)+(a>=b)*2+(a==b)*3+(a-b)*(a-b)+(b-a)*8+a*2-3;' -fsuperopt=superopt.rules -g
+assert 16 'a=5; return -(a+a)+a*7-a*a+a+(-a-a)+21;' -fsuperopt=superopt.rules -fhash-cons
+echo 'a=1; b=2; return (a+b)*(a-b);' | ./9cc -fsuperopt=superopt.rules - | grep -q lea ||
+   { echo "-fsuperopt rule not applied"; exit 1; }
+# Ranges that decide a comparison beat any rule for it, and a rule's
+# result keeps a range for the code above it.
+prog='a=3; b=5; c=(a<b)+(a*2+b); return c;'
+assert 12 "$prog" -fsuperopt=superopt.rules
+echo "$prog" | ./9cc -fsuperopt=superopt.rules - > tmp.s
+grep -q '^   mov \$1, %eax$' tmp.s && ! grep -q setl tmp.s && grep -q '^   add %edi, %eax$' tmp.s ||
+   { echo "-fsuperopt rule used where ranges decide"; exit 1; }
+
+rm -f 9cc.prof
+assert 9 'a=2; b=a*3; c=b+1; return c+a;' -finstrument-stmts
+[ "$(grep -vc '^#' 9cc.prof)" = 4 ] || { echo "expected 4 profile entries"; exit 1; }
+assert 9 'a=2; b=a*3; c=b+1; return c+a;' -fprofile-use=9cc.prof
+
+assert 8 'a=3; z=5; return a+z;' -fpipeline
+assert 10 'a=1; b=a+2; c=b*3; d=c-1; e=d+a; return e+b+d-c-a;' -fpipeline -g
+
+# -fpipeline must not change the output, errors included.
+big="a=0; b=1; $(for i in $(seq 1 3000); do echo "a=a+$i*b-(a/7); b=a-b*2;"; done) return a;"
+echo "$big" | ./9cc - > tmp1.s
+# The thread count is forced so the chunks are generated in parallel
+# even on a single-CPU host.
+for threads in 2 4 11; do
+   echo "$big" | ./9cc -fpipeline=$threads - > tmp2.s
+   cmp -s tmp1.s tmp2.s || { echo "-fpipeline=$threads output differs"; exit 1; }
+done
+[ "$(printf 'a=1+;\nb=(2;\n' | ./9cc -fpipeline - 2>&1 >/dev/null | grep -c '^-:')" = 2 ] || { echo "-fpipeline lost errors"; exit 1; }
+echo "-fpipeline => same output"
+
 assert 1 'return 1; 2; 3;'
 assert 2 '1; return 2; 3;'
 assert 3 '1; 2; return 3;'
 
+# Every broken statement is reported, with only its own line echoed.
+errors=$(printf 'a=1+;\nb=(2;\n3=b;\nc=@1;\nreturn a;\n' | ./9cc - 2>&1 >/dev/null)
+if [ "$(echo "$errors" | grep -c '^-:')" != 4 ] || echo "$errors" | grep -q 'return a'; then
+   echo "expected 4 diagnostics, got:"
+   echo "$errors"
+   exit 1
+fi
+echo "$errors"
+
+# Shared subtrees must not move diagnostics to their first occurrence.
+for flags in "" -fhash-cons; do
+   errors=$(printf 'x=a+1;\ny=2;\na+1=2;\n' | ./9cc $flags - 2>&1 >/dev/null)
+   echo "$errors" | grep -q '^-:3:4: a+1=2;$' ||
+      { echo "wrong location with '$flags':"; echo "$errors"; exit 1; }
+done
+echo "not an lvalue => reported on line 3 with and without -fhash-cons"
+
 echo OK
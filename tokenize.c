@@ -1,7 +1,24 @@
 #include "9cc.h"
 
+static char *current_filename;
 static char *current_input;
 
+int error_count;
+_Thread_local jmp_buf *error_recover;
+
+// Diagnostics may come from the tokenizer and parser threads at once
+// with -fpipeline.
+static pthread_mutex_t diag_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Byte offsets of the start of each line of `current_input`. Built on the
+// first diagnostic so that error-free compiles never pay for it.
+static int *line_starts;
+static int num_lines;
+
+// Position of the tokenizer, for stamping tokens with line and column.
+static int cur_line_no;
+static char *cur_line_start;
+
 void error(char *fmt, ...) { //::: Reports an error and exit.
    va_list ap;
    va_start(ap, fmt);
@@ -9,24 +26,82 @@ void error(char *fmt, ...) { //::: Reports an error and exit.
    fprintf(stderr, "\n");
    exit(1);
 } //;;;
-static void verror_at(char *loc, char *fmt, va_list ap) {  //::: Reports an error location and exit.
+static void build_line_starts(void) { //:::
+   int capacity = 1024;
+   line_starts = malloc(sizeof(int) * capacity);
+   line_starts[num_lines++] = 0;
+
+   for (char *p = current_input; *p; p++) {
+      if (*p != '\n')
+         continue;
+      if (num_lines == capacity) {
+         capacity *= 2;
+         line_starts = realloc(line_starts, sizeof(int) * capacity);
+      }
+      line_starts[num_lines++] = p + 1 - current_input;
+   }
+} //;;;
+static int find_line(char *loc) { //::: Returns the 0-based line containing `loc`.
+   if (!line_starts)
+      build_line_starts();
+
    int pos = loc - current_input;
-   fprintf(stderr, "%s\n", current_input);
-   fprintf(stderr, "%*s", pos, ""); // print pos spaces.
+   int lo = 0, hi = num_lines - 1;
+   while (lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if (line_starts[mid] <= pos)
+         lo = mid;
+      else
+         hi = mid - 1;
+   }
+   return lo;
+} //;;;
+static void verror_at(char *loc, char *fmt, va_list ap) {  //::: Reports an error location, printing only the offending line.
+   pthread_mutex_lock(&diag_lock);
+   int line_no = find_line(loc);
+   char *line = current_input + line_starts[line_no];
+   char *end = line;
+   while (*end && *end != '\n')
+      end++;
+   int col = loc - line;
+
+   int indent = fprintf(stderr, "%s:%d:%d: ", current_filename, line_no + 1, col + 1);
+   fprintf(stderr, "%.*s\n", (int)(end - line), line);
+   fprintf(stderr, "%*s", indent + col, ""); // print pos spaces.
    fprintf(stderr, "^ ");
    vfprintf(stderr, fmt, ap);
    fprintf(stderr, "\n");
+   error_count++;
+   pthread_mutex_unlock(&diag_lock);
+} //;;;
+static void bail(void) { //::: Unwind to the parser's recovery point, or exit if there is none.
+   if (error_recover)
+      longjmp(*error_recover, 1);
    exit(1);
 } //;;;
 void error_at(char *loc, char *fmt, ...) { //:::
    va_list ap;
    va_start(ap, fmt);
    verror_at(loc, fmt, ap);
+   va_end(ap);
+   bail();
 } //;;;
 void error_tok(Token *tok, char *fmt, ...) { //:::
    va_list ap;
    va_start(ap, fmt);
    verror_at(tok->loc, fmt, ap);
+   va_end(ap);
+   bail();
+} //;;;
+static void warn_at(char *loc, char *fmt, ...) { //::: Reports an error but keeps going.
+   va_list ap;
+   va_start(ap, fmt);
+   verror_at(loc, fmt, ap);
+   va_end(ap);
+} //;;;
+
+int source_offset(char *loc) { //::: Byte offset of `loc` from the start of the input.
+   return loc - current_input;
 } //;;;
 
 bool equal(Token *tok, char *op) { //::: Consumes the current token if it matches `op`.
@@ -43,6 +118,8 @@ static Token *new_token(TokenKind kind, char *start, char *end) { //::: Create a
    tok->kind = kind;
    tok->loc = start;
    tok->len = end - start;
+   tok->line_no = cur_line_no;
+   tok->col_no = start - cur_line_start + 1;
    return tok;
 } //;;;
 static bool startswith(char *p, char *q) { //:::
@@ -66,57 +143,76 @@ static int read_punct(char *p) { //::: Read a punctuator token from p and return
    return ispunct(*p) ? 1 : 0;
 } //;;;
 
-static void convert_keywords(Token *tok) {
-   for (Token *t = tok; t->kind != TK_EOF; t = t->next) {
-      if (equal(t, "return")) {
-         t->kind = TK_KEYWORD;
-      }
-   }
-}
+static bool is_keyword(Token *tok) { //:::
+   return equal(tok, "return");
+} //;;;
 
-Token *tokenize(char *p) { //::: Tokenize `current_input` and returns new tokens.
+// Tokenize `p`. Finished tokens are linked into a list, or handed to `q`
+// when it is set, in which case the consumer does the linking and the
+// tokens' `next` fields are never touched here.
+static Token *tokenize_into(char *filename, char *p, Queue *q) { //:::
+  current_filename = filename;
   current_input = p;
+  cur_line_no = 1;
+  cur_line_start = p;
   Token head = {};
   Token *cur = &head;
 
-  while (*p) {
+  for (;;) {
     // Skip whitespace characters.
     if (isspace(*p)) {
-      p++;
+      if (*p++ == '\n') {
+        cur_line_no++;
+        cur_line_start = p;
+      }
       continue;
     }
 
-    // Numeric literal
-    if (isdigit(*p)) {
-      cur = cur->next = new_token(TK_NUM, p, p);
-      char *q = p;
-      cur->val = strtoul(p, &p, 10);
-      cur->len = p - q;
-      continue;
-    }
+    Token *tok;
+    int punct_len;
 
-    // Identifier or keyword
-    if (is_ident1(*p)) {
+    if (!*p) {
+      tok = new_token(TK_EOF, p, p);
+    } else if (isdigit(*p)) {
+      // Numeric literal
+      tok = new_token(TK_NUM, p, p);
+      char *start = p;
+      tok->val = strtoul(p, &p, 10);
+      tok->len = p - start;
+    } else if (is_ident1(*p)) {
+      // Identifier or keyword
       char *start = p;
       do {
         p++;
       } while (is_ident2(*p));
-      cur = cur->next = new_token(TK_IDENT, start, p);
+      tok = new_token(TK_IDENT, start, p);
+      if (is_keyword(tok))
+        tok->kind = TK_KEYWORD;
+    } else if ((punct_len = read_punct(p))) {
+      // Punctuators
+      tok = new_token(TK_PUNCT, p, p + punct_len);
+      p += punct_len;
+    } else {
+      // Report and skip the character so that later errors are found too.
+      warn_at(p, "invalid token");
+      p++;
       continue;
     }
 
-    // Punctuators
-    int punct_len = read_punct(p);
-    if (punct_len) {
-      cur = cur->next = new_token(TK_PUNCT, p, p + punct_len);
-      p += cur->len;
-      continue;
-    }
+    if (q)
+      queue_push(q, tok);
+    else
+      cur = cur->next = tok;
 
-    error_at(p, "invalid token");
+    if (tok->kind == TK_EOF)
+      return head.next;
   }
+} //;;;
+
+Token *tokenize(char *filename, char *p) { //::: Tokenize `p` and returns new tokens.
+  return tokenize_into(filename, p, NULL);
+} //;;;
 
-  cur = cur->next = new_token(TK_EOF, p, p);
-  convert_keywords(head.next);
-  return head.next;
+void tokenize_to_queue(char *filename, char *p, Queue *q) { //::: Tokenize `p`, pushing each token to `q` as it is finished.
+  tokenize_into(filename, p, q);
 } //;;;
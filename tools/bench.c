@@ -0,0 +1,99 @@
+// bench.c: timing driver for generated code.
+//
+// Linked against an object defining `long bench_fn(void)` (9cc's main
+// renamed, or the same program compiled by cc), it calls the function in
+// a timed loop and prints one line:
+//
+//   <cycles/iter> <ns/iter> <instructions/iter>
+//
+// Cycles are TSC ticks. Instructions come from perf_event_open and are
+// printed as "n/a" where the kernel does not allow it.
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define RUNS 7
+#define MIN_RUN_NS 20000000 // Grow the iteration count until a run takes this long
+
+long bench_fn(void);
+
+// Called through a volatile pointer so the loop cannot be folded away.
+static long (*volatile fn)(void) = bench_fn;
+static volatile long sink;
+
+static int open_insn_counter(void) { //:::
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.size = sizeof(attr);
+   attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+   attr.disabled = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+} //;;;
+
+static int64_t now_ns(void) { //:::
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} //;;;
+
+static void loop(long iters) { //:::
+   for (long i = 0; i < iters; i++)
+      sink = fn();
+} //;;;
+
+int main(void) {
+   // Calibrate.
+   long iters = 1;
+   for (;;) {
+      int64_t t = now_ns();
+      loop(iters);
+      if (now_ns() - t >= MIN_RUN_NS)
+         break;
+      iters *= 2;
+   }
+
+   // Keep the fastest run: anything slower was disturbed.
+   double best_cycles = 1e300, best_ns = 1e300;
+   for (int i = 0; i < RUNS; i++) {
+      int64_t t = now_ns();
+      uint64_t c = __rdtsc();
+      loop(iters);
+      uint64_t cycles = __rdtsc() - c;
+      int64_t ns = now_ns() - t;
+
+      if ((double)cycles / iters < best_cycles)
+         best_cycles = (double)cycles / iters;
+      if ((double)ns / iters < best_ns)
+         best_ns = (double)ns / iters;
+   }
+
+   // The numbers include the loop and call overhead, which is the same
+   // for every variant.
+   int fd = open_insn_counter();
+   if (fd < 0) {
+      printf("%.2f %.2f n/a\n", best_cycles, best_ns);
+      return 0;
+   }
+
+   uint64_t count;
+   ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+   ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+   loop(iters);
+   ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+   if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+      printf("%.2f %.2f n/a\n", best_cycles, best_ns);
+      return 0;
+   }
+   printf("%.2f %.2f %.1f\n", best_cycles, best_ns, (double)count / iters);
+   return 0;
+}
@@ -0,0 +1,77 @@
+#!/bin/bash
+# Measure the code 9cc generates against cc -O0 and cc -O2 on the same
+# programs. Each program's main body is compiled into `long bench_fn(void)`
+# and called in a timed loop by tools/bench.c. A program's first line
+# assigns its inputs, which neither compiler is allowed to treat as
+# constants.
+#
+# usage: tools/bench.sh [9cc flags...] [-- program...]
+# Programs default to bench/*.c. Flags are passed to 9cc only.
+set -e
+
+CC=${CC:-cc}
+flags=()
+while [ $# -gt 0 ] && [ "$1" != -- ]; do
+   flags+=("$1")
+   shift
+done
+[ "$1" = -- ] && shift
+programs=("$@")
+[ ${#programs[@]} -eq 0 ] && programs=(bench/*.c)
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+$CC -O2 -c -o "$tmp/driver.o" tools/bench.c
+
+# Size in bytes of bench_fn in an object file.
+fn_size() {
+   local hex=$(nm -S --defined-only "$1" | awk '$4 == "bench_fn" { print $2 }')
+   echo $((16#$hex))
+}
+
+# Build $tmp/$2 from object $1 and print "<size> <cycles> <ns> <insns>".
+measure() {
+   $CC -o "$tmp/$2" "$tmp/driver.o" "$1" 2>/dev/null
+   echo "$(fn_size "$1") $("$tmp/$2")"
+}
+
+printf '%-22s %-10s %8s %12s %10s %12s\n' program compiler bytes cycles/iter ns/iter insns/iter
+
+for prog in "${programs[@]}"; do
+   name=$(basename "$prog" .c)
+
+   # The first line sets the inputs. Hide their values from both
+   # compilers so neither can fold the whole program to a constant: 9cc
+   # through -fopaque, cc through an empty asm after the line.
+   inputs=$(head -n 1 "$prog" | grep -o '[A-Za-z_][A-Za-z0-9_]*' | grep -vx return | sort -u)
+   opaque=()
+   [ -n "$inputs" ] && opaque=(-fopaque=$(echo "$inputs" | paste -sd, -))
+
+   ./9cc "${flags[@]}" "${opaque[@]}" "$prog" | sed 's/\bmain\b/bench_fn/g' > "$tmp/9cc.s"
+   $CC -c -o "$tmp/9cc.o" "$tmp/9cc.s"
+
+   # As C, every identifier other than "return" is a long local.
+   vars=$(grep -o '[A-Za-z_][A-Za-z0-9_]*' "$prog" | grep -vx return | sort -u | paste -sd, -)
+   {
+      echo "long bench_fn(void) {"
+      [ -n "$vars" ] && echo "long $vars;"
+      head -n 1 "$prog"
+      for v in $inputs; do
+         echo "__asm__(\"\" : \"+r\"($v));"
+      done
+      tail -n +2 "$prog"
+      echo "}"
+   } > "$tmp/prog.c"
+   $CC -O0 -w -fwrapv -c -o "$tmp/O0.o" "$tmp/prog.c"
+   $CC -O2 -w -fwrapv -c -o "$tmp/O2.o" "$tmp/prog.c"
+
+   for variant in 9cc O0 O2; do
+      case $variant in
+      9cc) label="9cc ${flags[*]}" ;;
+      *) label="$CC -$variant" ;;
+      esac
+      read -r size cycles ns insns <<< "$(measure "$tmp/$variant.o" "$variant")"
+      printf '%-22s %-10s %8s %12s %10s %12s\n' "$name" "$label" "$size" "$cycles" "$ns" "$insns"
+   done
+done
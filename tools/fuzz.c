@@ -0,0 +1,461 @@
+// fuzz.c: differential fuzzer for 9cc.
+//
+// Generates random programs in the grammar 9cc accepts and compiles each
+// one with 9cc at -O0, -O, -O -fhash-cons and -O with the superoptimiser
+// rules in superopt.rules, with the legacy single-file
+// compiler (9cc-legacy) when the program is a bare expression, and with
+// the system C compiler as the reference. The exit statuses must all
+// agree. A disagreeing program is shrunk and saved as fuzz-fail-<n>.c.
+//
+// usage: tools/fuzz [-n iterations] [-s seed]
+//   -n 0 runs until interrupted.
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define MAX_DEPTH 6
+#define MAX_STMTS 24
+#define NUM_VARS 26 // a..z, more than the 11 registers 9cc gives to locals
+#define WINDOW 6    // Locals one statement may mention
+
+typedef enum {
+   E_NUM,
+   E_VAR,
+   E_NEG,
+   E_BIN,
+} ExprKind;
+
+typedef struct Expr Expr;
+struct Expr {
+   ExprKind kind;
+   char *op;      // E_BIN
+   int val;       // E_NUM
+   char var;      // E_VAR
+   bool divisor;  // Right operand of "/"; must stay a literal other than 0 and -1
+   Expr *lhs;
+   Expr *rhs;
+};
+
+typedef struct Program Program;
+struct Program {
+   bool legacy;            // A bare expression the legacy compiler accepts
+   char targets[MAX_STMTS];
+   Expr *values[MAX_STMTS];
+   int nstmts;
+   Expr *ret;
+};
+
+typedef struct Config Config;
+struct Config {
+   char *name;
+   char *flags[3];
+   bool legacy; // Run 9cc-legacy instead of 9cc
+};
+
+static Config configs[] = {
+   {"9cc -O0", {"-O0"}},
+   {"9cc -O", {"-O"}},
+   {"9cc -O -fhash-cons", {"-O", "-fhash-cons"}},
+   {"9cc -O -fsuperopt", {"-O", "-fsuperopt=superopt.rules"}},
+   {"9cc-legacy", {NULL}, true},
+};
+#define NUM_CONFIGS (sizeof(configs) / sizeof(*configs))
+
+static char *binops[] = {"+", "-", "*", "/", "==", "!=", "<", "<=", ">", ">="};
+
+static char workdir[] = "/tmp/9cc-fuzz-XXXXXX";
+
+//// Program generation :::
+
+static Expr *new_num(int val) { //:::
+   Expr *e = calloc(1, sizeof(Expr));
+   e->kind = E_NUM;
+   e->val = val;
+   return e;
+} //;;;
+
+static Expr *gen_expr(int depth, int first, int nvars) { //::: Reads nvars locals from the first'th on
+   if (depth == 0 || rand() % 4 == 0) {
+      if (nvars && rand() % 2) {
+         Expr *e = calloc(1, sizeof(Expr));
+         e->kind = E_VAR;
+         e->var = 'a' + first + rand() % nvars;
+         return e;
+      }
+      return new_num(rand() % 100);
+   }
+
+   Expr *e = calloc(1, sizeof(Expr));
+   if (rand() % 8 == 0) {
+      e->kind = E_NEG;
+      e->lhs = gen_expr(depth - 1, first, nvars);
+      return e;
+   }
+
+   e->kind = E_BIN;
+   e->op = binops[rand() % (sizeof(binops) / sizeof(*binops))];
+   e->lhs = gen_expr(depth - 1, first, nvars);
+
+   // Only divide by literals other than 0 and -1 so that no compiler
+   // traps or hits the one overflowing quotient, INT64_MIN / -1.
+   if (!strcmp(e->op, "/")) {
+      int val = 1 + rand() % 9;
+      e->rhs = new_num(val > 1 && rand() % 2 ? -val : val);
+      e->rhs->divisor = true;
+   } else {
+      e->rhs = gen_expr(depth - 1, first, nvars);
+   }
+   return e;
+} //;;;
+
+static void gen_program(Program *prog) { //:::
+   memset(prog, 0, sizeof(*prog));
+   prog->legacy = rand() % 3 == 0;
+   if (prog->legacy) {
+      prog->ret = gen_expr(1 + rand() % MAX_DEPTH, 0, 0);
+      return;
+   }
+
+   // Each statement touches a random window of the locals, so live
+   // ranges vary in length and sometimes more locals are live than fit
+   // in registers: -O then has to spill and share slots and registers.
+   prog->nstmts = rand() % (MAX_STMTS + 1);
+   for (int i = 0; i < prog->nstmts; i++) {
+      int first = rand() % (NUM_VARS - WINDOW + 1);
+      prog->targets[i] = 'a' + first + rand() % WINDOW;
+      prog->values[i] = gen_expr(1 + rand() % MAX_DEPTH, first, WINDOW);
+   }
+   prog->ret = gen_expr(1 + rand() % MAX_DEPTH, rand() % (NUM_VARS - WINDOW + 1), WINDOW);
+} //;;;
+
+//;;;
+//// Printing :::
+
+// `c_suffix` is appended to literals in the C reference so arithmetic is
+// done in 64 bits as it is by 9cc.
+static void print_expr(FILE *out, Expr *e, char *c_suffix) { //:::
+   switch (e->kind) {
+   case E_NUM:
+      fprintf(out, "%d%s", e->val, c_suffix);
+      return;
+   case E_VAR:
+      fprintf(out, "%c", e->var);
+      return;
+   case E_NEG:
+      fprintf(out, "-(");
+      print_expr(out, e->lhs, c_suffix);
+      fprintf(out, ")");
+      return;
+   case E_BIN:
+      // Fully parenthesised: the legacy compiler mishandles chains of ">".
+      fprintf(out, "(");
+      print_expr(out, e->lhs, c_suffix);
+      fprintf(out, " %s ", e->op);
+      print_expr(out, e->rhs, c_suffix);
+      fprintf(out, ")");
+      return;
+   }
+} //;;;
+
+// Zero each local read by `e` that has not been assigned yet, as the
+// globals in the C version are. Doing it just before the first read
+// keeps live ranges as short as the program allows.
+static void print_inits(FILE *out, Expr *e, bool *assigned) { //:::
+   if (e->kind == E_VAR && !assigned[e->var - 'a']) {
+      fprintf(out, "%c=0; ", e->var);
+      assigned[e->var - 'a'] = true;
+   }
+   if (e->lhs)
+      print_inits(out, e->lhs, assigned);
+   if (e->rhs)
+      print_inits(out, e->rhs, assigned);
+} //;;;
+
+static void print_9cc(FILE *out, Program *prog) { //:::
+   bool assigned[NUM_VARS] = {};
+   for (int i = 0; i < prog->nstmts; i++) {
+      print_inits(out, prog->values[i], assigned);
+      fprintf(out, "%c = ", prog->targets[i]);
+      print_expr(out, prog->values[i], "");
+      fprintf(out, ";\n");
+      assigned[prog->targets[i] - 'a'] = true;
+   }
+   print_inits(out, prog->ret, assigned);
+   fprintf(out, "return ");
+   print_expr(out, prog->ret, "");
+   fprintf(out, ";\n");
+} //;;;
+
+static void print_c(FILE *out, Program *prog) { //:::
+   fprintf(out, "long a");
+   for (int i = 1; i < NUM_VARS; i++)
+      fprintf(out, ", %c", 'a' + i);
+   fprintf(out, ";\n");
+   fprintf(out, "int main(void) {\n");
+   for (int i = 0; i < prog->nstmts; i++) {
+      fprintf(out, "   %c = ", prog->targets[i]);
+      print_expr(out, prog->values[i], "L");
+      fprintf(out, ";\n");
+   }
+   fprintf(out, "   return ");
+   print_expr(out, prog->ret, "L");
+   fprintf(out, ";\n}\n");
+} //;;;
+
+static char *expr_string(Expr *e) { //:::
+   char *buf;
+   size_t len;
+   FILE *out = open_memstream(&buf, &len);
+   print_expr(out, e, "");
+   fclose(out);
+   return buf;
+} //;;;
+
+//;;;
+//// Running :::
+
+// Run `argv` with stdout sent to `out` (if not NULL) and stderr discarded.
+// Returns the exit status, or 256 + signal number if it was killed.
+static int spawn(char **argv, char *out) { //:::
+   pid_t pid = fork();
+   if (pid < 0) {
+      perror("fork");
+      exit(1);
+   }
+
+   if (pid == 0) {
+      int fd = open("/dev/null", O_WRONLY);
+      dup2(fd, 2);
+      if (out) {
+         int ofd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+         dup2(ofd, 1);
+      }
+      execvp(argv[0], argv);
+      _exit(127);
+   }
+
+   int status;
+   waitpid(pid, &status, 0);
+   if (WIFSIGNALED(status))
+      return 256 + WTERMSIG(status);
+   return WEXITSTATUS(status);
+} //;;;
+
+static char *path(char *name) { //:::
+   static char buf[4][256];
+   static int i;
+   char *p = buf[i++ % 4];
+   snprintf(p, 256, "%s/%s", workdir, name);
+   return p;
+} //;;;
+
+static char *cc(void) { //:::
+   char *cc = getenv("CC");
+   return cc ? cc : "cc";
+} //;;;
+
+// Returns the low 8 bits of the program's result, or a value above 255
+// if it crashed, or -1 if it did not compile.
+static int run_config(Config *cfg, Program *prog) { //:::
+   if (cfg->legacy) {
+      char *src = expr_string(prog->ret);
+      int st = spawn((char *[]){"./9cc-legacy", src, NULL}, path("out.s"));
+      free(src);
+      if (st)
+         return -1;
+   } else {
+      FILE *fp = fopen(path("prog.c"), "w");
+      print_9cc(fp, prog);
+      fclose(fp);
+
+      char *argv[8] = {"./9cc"};
+      int argc = 1;
+      for (int i = 0; cfg->flags[i]; i++)
+         argv[argc++] = cfg->flags[i];
+      argv[argc++] = path("prog.c");
+      if (spawn(argv, path("out.s")))
+         return -1;
+   }
+
+   if (spawn((char *[]){cc(), "-o", path("out"), path("out.s"), NULL}, NULL))
+      return -1;
+   return spawn((char *[]){path("out"), NULL}, NULL);
+} //;;;
+
+static int run_reference(Program *prog) { //:::
+   FILE *fp = fopen(path("ref.c"), "w");
+   print_c(fp, prog);
+   fclose(fp);
+
+   if (spawn((char *[]){cc(), "-w", "-fwrapv", "-o", path("ref"), path("ref.c"), NULL}, NULL))
+      return -1;
+   return spawn((char *[]){path("ref"), NULL}, NULL);
+} //;;;
+
+// Returns true if every applicable configuration agrees with the reference.
+static bool check(Program *prog, int *results, int *expected) { //:::
+   *expected = run_reference(prog);
+   if (*expected < 0)
+      return true; // Not a valid C program; not our problem.
+
+   bool ok = true;
+   for (int i = 0; i < NUM_CONFIGS; i++) {
+      results[i] = 0;
+      if (configs[i].legacy && !prog->legacy)
+         continue;
+      results[i] = run_config(&configs[i], prog);
+      if (results[i] != *expected)
+         ok = false;
+   }
+   return ok;
+} //;;;
+
+//;;;
+//// Shrinking :::
+
+static void collect_slots(Expr **slot, Expr ***slots, int *n) { //:::
+   slots[(*n)++] = slot;
+   if ((*slot)->lhs)
+      collect_slots(&(*slot)->lhs, slots, n);
+   if ((*slot)->rhs)
+      collect_slots(&(*slot)->rhs, slots, n);
+} //;;;
+
+static bool fails(Program *prog) { //:::
+   int results[NUM_CONFIGS], expected;
+   return !check(prog, results, &expected);
+} //;;;
+
+// Greedily replace subexpressions by their operands or by small literals,
+// and drop statements, for as long as the program keeps failing.
+static void shrink(Program *prog) { //:::
+   bool progress = true;
+   while (progress) {
+      progress = false;
+
+      for (int i = 0; i < prog->nstmts; i++) {
+         Program smaller = *prog;
+         memmove(&smaller.targets[i], &smaller.targets[i + 1], prog->nstmts - i - 1);
+         memmove(&smaller.values[i], &smaller.values[i + 1], sizeof(Expr *) * (prog->nstmts - i - 1));
+         smaller.nstmts--;
+         if (fails(&smaller)) {
+            *prog = smaller;
+            progress = true;
+            i--;
+         }
+      }
+
+      Expr **slots[4096];
+      int n = 0;
+      for (int i = 0; i < prog->nstmts; i++)
+         collect_slots(&prog->values[i], slots, &n);
+      collect_slots(&prog->ret, slots, &n);
+
+      for (int i = 0; i < n && !progress; i++) {
+         Expr *orig = *slots[i];
+         // A divisor stays a nonzero literal through later passes too.
+         Expr *literal = new_num(orig->divisor ? 1 : 0);
+         literal->divisor = orig->divisor;
+         Expr *candidates[] = {orig->lhs, orig->rhs, literal};
+
+         for (int j = 0; j < 3 && !progress; j++) {
+            Expr *c = candidates[j];
+            if (!c || (orig->kind == E_NUM && orig->val == c->val))
+               continue;
+            if (orig->divisor && c->kind != E_NUM)
+               continue;
+            *slots[i] = c;
+            if (fails(prog))
+               progress = true;
+            else
+               *slots[i] = orig;
+         }
+      }
+   }
+} //;;;
+
+//;;;
+
+static void report(Program *prog, int nfail) { //:::
+   int results[NUM_CONFIGS], expected;
+   check(prog, results, &expected);
+
+   char name[64];
+   snprintf(name, sizeof(name), "fuzz-fail-%d.c", nfail);
+   FILE *fp = fopen(name, "w");
+   fprintf(fp, "// expected %d (cc -fwrapv)\n", expected);
+   for (int i = 0; i < NUM_CONFIGS; i++)
+      if (!configs[i].legacy || prog->legacy)
+         fprintf(fp, "// %-20s %d\n", configs[i].name, results[i]);
+   print_9cc(fp, prog);
+   fclose(fp);
+
+   fprintf(stderr, "\nmismatch, shrunk case saved to %s:\n", name);
+   print_9cc(stderr, prog);
+} //;;;
+
+static double now(void) { //:::
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+} //;;;
+
+int main(int argc, char **argv) {
+   long iterations = 1000;
+   unsigned seed = time(NULL);
+
+   int c;
+   while ((c = getopt(argc, argv, "n:s:")) != -1) {
+      if (c == 'n')
+         iterations = atol(optarg);
+      else if (c == 's')
+         seed = strtoul(optarg, NULL, 10);
+      else
+         return 2;
+   }
+
+   if (!mkdtemp(workdir)) {
+      perror("mkdtemp");
+      return 1;
+   }
+
+   fprintf(stderr, "seed %u\n", seed);
+   srand(seed);
+
+   double start = now();
+   double last_report = start;
+   int nfail = 0;
+   long i;
+
+   for (i = 0; iterations == 0 || i < iterations; i++) {
+      Program prog;
+      gen_program(&prog);
+
+      int results[NUM_CONFIGS], expected;
+      if (!check(&prog, results, &expected)) {
+         shrink(&prog);
+         report(&prog, nfail++);
+      }
+
+      double t = now();
+      if (t - last_report >= 1) {
+         fprintf(stderr, "\r%ld programs, %.1f programs/s, %d failures", i + 1,
+                 (i + 1) / (t - start), nfail);
+         last_report = t;
+      }
+   }
+
+   double t = now();
+   fprintf(stderr, "\r%ld programs, %.1f programs/s, %d failures\n", i, i / (t - start), nfail);
+
+   for (char **f = (char *[]){"prog.c", "out.s", "out", "ref.c", "ref", NULL}; *f; f++)
+      unlink(path(*f));
+   rmdir(workdir);
+   return nfail ? 1 : 0;
+}
@@ -0,0 +1,478 @@
+// superopt.c: exhaustive superoptimiser for small expression patterns.
+//
+// For each pattern, a 9cc expression such as "(a+b)*(a-b)", enumerates
+// every sequence of up to -l instructions over a small x86-64 subset and
+// keeps the shortest one, then the one with the lowest summed latency,
+// that computes the pattern. The first variable arrives in %rdi, the
+// second in %rdx and the result is left in %rax, as codegen expects.
+//
+// A candidate must first agree with the pattern on a few test vectors,
+// then on random 64-bit inputs, and finally on every input in a small
+// domain ([-128,127] for two variables, [-32768,32767] for one). Found
+// rules are merged into the rule database read by 9cc -fsuperopt=.
+//
+// usage: tools/superopt [-l max-length] [-o rules-file] pattern...
+//   Defaults: -l 3 -o superopt.rules
+#include "../9cc.h"
+
+bool opt_hash_cons; // Read by the parser; patterns are never shared
+char *opt_opaque;   // Likewise; patterns have no ranges
+
+#define MAX_LEN 5
+#define MAX_CONSTS 8
+#define MAX_INSNS 512
+#define NFAST 8     // Vectors every candidate is run on
+#define NRANDOM 256 // Random vectors run on survivors
+
+enum { RAX, RDI, RDX, NREGS, NOBASE = NREGS };
+
+static char *reg64[] = {"%rax", "%rdi", "%rdx"};
+static char *reg32[] = {"%eax", "%edi", "%edx"};
+static char *reg8[] = {"%al", "%dil", "%dl"};
+
+typedef enum {
+   I_MOV,   // mov src, dst
+   I_MOVI,  // mov $imm, dst
+   I_ADD,   // add src, dst
+   I_ADDI,  // add $imm, dst
+   I_SUB,   // sub src, dst
+   I_IMUL,  // imul src, dst
+   I_IMULI, // imul $imm, src, dst
+   I_XOR,   // xor src, dst
+   I_NEG,   // neg dst
+   I_SHL,   // shl $imm, dst
+   I_LEA,   // lea (src,idx,scale), dst; src may be NOBASE
+   I_CMP,   // cmp src, dst
+   I_SETCC, // set<cc> dst8
+   I_MOVZB, // movzbl dst8, dst32
+} Op;
+
+typedef enum { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE, NCC } Cond;
+
+static char *cc_names[] = {"e", "ne", "l", "le", "g", "ge"};
+
+typedef struct Insn Insn;
+struct Insn {
+   Op op;
+   int dst, src, idx, scale;
+   long imm;
+   Cond cc;
+};
+
+// Registers and the operands of the last cmp. Only cmp is modelled as
+// setting flags; the arithmetic instructions leave them unknown.
+typedef struct Machine Machine;
+struct Machine {
+   uint64_t r[NREGS + 1]; // r[NOBASE] is always 0
+   bool flags;
+   int64_t lhs, rhs;
+};
+
+typedef struct Vector Vector;
+struct Vector {
+   uint64_t in[SUPEROPT_MAX_INPUTS];
+   uint64_t garbage; // Initial value of the registers that hold no input
+};
+
+static Insn insns[MAX_INSNS];
+static int ninsns;
+
+static Node *pattern;
+static Obj *inputs[SUPEROPT_MAX_INPUTS];
+static int ninputs;
+
+static Vector fast[NFAST];
+static uint64_t fast_expected[NFAST];
+static Machine states[MAX_LEN + 1][NFAST];
+
+static int len;
+static Insn seq[MAX_LEN];
+static Insn best[MAX_LEN];
+static int best_latency;
+static long candidates; // Sequences passing the fast vectors
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static uint64_t rng(void) { //::: xorshift64*
+   rng_state ^= rng_state >> 12;
+   rng_state ^= rng_state << 25;
+   rng_state ^= rng_state >> 27;
+   return rng_state * 0x2545f4914f6cdd1d;
+} //;;;
+
+static uint64_t eval(Node *node, uint64_t *in) { //::: The pattern's value, with 64-bit wrapping arithmetic.
+   switch (node->kind) {
+   case ND_NUM:
+      return (int64_t)node->val;
+   case ND_VAR:
+      for (int i = 0; i < ninputs; i++)
+         if (inputs[i] == node->var)
+            return in[i];
+      break;
+   case ND_NEG:
+      return -eval(node->lhs, in);
+   }
+
+   uint64_t x = eval(node->lhs, in);
+   uint64_t y = eval(node->rhs, in);
+   switch (node->kind) {
+   case ND_ADD: return x + y;
+   case ND_SUB: return x - y;
+   case ND_MUL: return x * y;
+   case ND_EQ:  return x == y;
+   case ND_NE:  return x != y;
+   case ND_LT:  return (int64_t)x < (int64_t)y;
+   case ND_LE:  return (int64_t)x <= (int64_t)y;
+   }
+   error("unsupported operator in pattern");
+} //;;;
+
+static void reset(Machine *m, Vector *v) { //:::
+   m->r[RAX] = v->garbage;
+   m->r[RDI] = ninputs > 0 ? v->in[0] : v->garbage;
+   m->r[RDX] = ninputs > 1 ? v->in[1] : v->garbage;
+   m->r[NOBASE] = 0;
+   m->flags = false;
+} //;;;
+
+static bool exec(Insn *i, Machine *m) { //::: Returns false if the instruction reads undefined flags.
+   uint64_t *r = m->r;
+   switch (i->op) {
+   case I_MOV:   r[i->dst] = r[i->src]; return true;
+   case I_MOVI:  r[i->dst] = i->imm; return true;
+   case I_ADD:   r[i->dst] += r[i->src]; break;
+   case I_ADDI:  r[i->dst] += i->imm; break;
+   case I_SUB:   r[i->dst] -= r[i->src]; break;
+   case I_IMUL:  r[i->dst] *= r[i->src]; break;
+   case I_IMULI: r[i->dst] = r[i->src] * i->imm; break;
+   case I_XOR:   r[i->dst] ^= r[i->src]; break;
+   case I_NEG:   r[i->dst] = -r[i->dst]; break;
+   case I_SHL:   r[i->dst] <<= i->imm; break;
+   case I_LEA:   r[i->dst] = r[i->src] + r[i->idx] * i->scale; return true;
+   case I_MOVZB: r[i->dst] &= 0xff; return true;
+   case I_CMP:
+      m->flags = true;
+      m->lhs = r[i->dst];
+      m->rhs = r[i->src];
+      return true;
+   case I_SETCC: {
+      if (!m->flags)
+         return false;
+      bool b;
+      switch (i->cc) {
+      case CC_E:  b = m->lhs == m->rhs; break;
+      case CC_NE: b = m->lhs != m->rhs; break;
+      case CC_L:  b = m->lhs < m->rhs; break;
+      case CC_LE: b = m->lhs <= m->rhs; break;
+      case CC_G:  b = m->lhs > m->rhs; break;
+      case CC_GE: b = m->lhs >= m->rhs; break;
+      }
+      r[i->dst] = (r[i->dst] & ~0xffUL) | b;
+      return true;
+   }
+   }
+   m->flags = false;
+   return true;
+} //;;;
+
+static int latency(Insn *i) { //:::
+   return i->op == I_IMUL || i->op == I_IMULI ? 3 : 1;
+} //;;;
+
+static void print_insn(FILE *out, Insn *i) { //:::
+   char *d = reg64[i->dst], *s = i->src < NREGS ? reg64[i->src] : NULL;
+   switch (i->op) {
+   case I_MOV:   fprintf(out, "mov %s, %s", s, d); return;
+   case I_MOVI:  fprintf(out, "mov $%ld, %s", i->imm, d); return;
+   case I_ADD:   fprintf(out, "add %s, %s", s, d); return;
+   case I_ADDI:  fprintf(out, "add $%ld, %s", i->imm, d); return;
+   case I_SUB:   fprintf(out, "sub %s, %s", s, d); return;
+   case I_IMUL:  fprintf(out, "imul %s, %s", s, d); return;
+   case I_IMULI: fprintf(out, "imul $%ld, %s, %s", i->imm, s, d); return;
+   case I_XOR:   fprintf(out, "xor %s, %s", s, d); return;
+   case I_NEG:   fprintf(out, "neg %s", d); return;
+   case I_SHL:   fprintf(out, "shl $%ld, %s", i->imm, d); return;
+   case I_CMP:   fprintf(out, "cmp %s, %s", s, d); return;
+   case I_SETCC: fprintf(out, "set%s %s", cc_names[i->cc], reg8[i->dst]); return;
+   case I_MOVZB: fprintf(out, "movzbl %s, %s", reg8[i->dst], reg32[i->dst]); return;
+   case I_LEA:
+      if (i->src == NOBASE)
+         fprintf(out, "lea (,%s,%d), %s", reg64[i->idx], i->scale, d);
+      else if (i->scale == 1)
+         fprintf(out, "lea (%s,%s), %s", s, reg64[i->idx], d);
+      else
+         fprintf(out, "lea (%s,%s,%d), %s", s, reg64[i->idx], i->scale, d);
+      return;
+   }
+} //;;;
+
+static void add_insn(Insn i) { //:::
+   if (ninsns == MAX_INSNS)
+      error("too many candidate instructions");
+   insns[ninsns++] = i;
+} //;;;
+
+static void collect_consts(Node *node, long *consts, int *n) { //:::
+   if (!node)
+      return;
+   if (node->kind == ND_NUM) {
+      for (int i = 0; i < *n; i++)
+         if (consts[i] == node->val)
+            return;
+      if (*n < MAX_CONSTS)
+         consts[(*n)++] = node->val;
+      return;
+   }
+   collect_consts(node->lhs, consts, n);
+   collect_consts(node->rhs, consts, n);
+} //;;;
+
+static void build_insns(void) { //::: The instruction set for the current pattern.
+   ninsns = 0;
+   for (int d = 0; d < NREGS; d++) {
+      for (int s = 0; s < NREGS; s++) {
+         if (s != d) {
+            add_insn((Insn){I_MOV, d, s});
+            add_insn((Insn){I_CMP, d, s});
+         }
+         add_insn((Insn){I_XOR, d, s}); // First, so ties zero with xor
+         add_insn((Insn){I_ADD, d, s});
+         add_insn((Insn){I_SUB, d, s});
+         add_insn((Insn){I_IMUL, d, s});
+         for (int x = 0; x < NREGS; x++)
+            for (int scale = 1; scale <= 8; scale *= 2)
+               add_insn((Insn){I_LEA, d, s, x, scale});
+      }
+      for (int x = 0; x < NREGS; x++)
+         for (int scale = 2; scale <= 8; scale *= 2)
+            add_insn((Insn){I_LEA, d, NOBASE, x, scale});
+      add_insn((Insn){I_NEG, d});
+      add_insn((Insn){I_MOVZB, d});
+      for (Cond cc = 0; cc < NCC; cc++)
+         add_insn((Insn){I_SETCC, d, .cc = cc});
+      for (int k = 1; k <= 4; k++)
+         add_insn((Insn){I_SHL, d, .imm = k});
+   }
+
+   // Immediates are limited to the pattern's own constants.
+   long consts[MAX_CONSTS];
+   int nconsts = 0;
+   collect_consts(pattern, consts, &nconsts);
+   for (int c = 0; c < nconsts; c++) {
+      for (int d = 0; d < NREGS; d++) {
+         add_insn((Insn){I_MOVI, d, .imm = consts[c]});
+         add_insn((Insn){I_ADDI, d, .imm = consts[c]});
+         for (int s = 0; s < NREGS; s++)
+            add_insn((Insn){I_IMULI, d, s, .imm = consts[c]});
+      }
+   }
+} //;;;
+
+static bool run(Vector *v) { //::: Whether the current sequence computes the pattern on `v`.
+   Machine m;
+   reset(&m, v);
+   for (int i = 0; i < len; i++)
+      if (!exec(&seq[i], &m))
+         return false;
+   return m.r[RAX] == eval(pattern, v->in);
+} //;;;
+
+static int64_t random_input(void) { //::: Biased towards small and equal values, where comparisons flip.
+   switch (rng() % 4) {
+   case 0:
+      return (int64_t)(rng() % 17) - 8;
+   case 1:
+      return (int64_t)(rng() % 0x10000) - 0x8000;
+   }
+   return rng();
+} //;;;
+
+static bool verify(void) { //::: Random vectors, then the whole small domain.
+   for (int i = 0; i < NRANDOM; i++) {
+      Vector v = {{random_input(), random_input()}, rng()};
+      if (i % 8 == 0)
+         v.in[1] = v.in[0];
+      if (!run(&v))
+         return false;
+   }
+
+   int lo = ninputs == 2 ? -128 : -32768;
+   int hi = ninputs == 2 ? 127 : 32767;
+   if (ninputs == 0)
+      lo = hi = 0;
+   for (int x = lo; x <= hi; x++) {
+      for (int y = ninputs == 2 ? lo : 0; y <= (ninputs == 2 ? hi : 0); y++) {
+         Vector v = {{x, y}, rng()};
+         if (!run(&v))
+            return false;
+      }
+   }
+   return true;
+} //;;;
+
+static void search(int depth) { //:::
+   for (int k = 0; k < ninsns; k++) {
+      Insn *insn = &insns[k];
+      bool last = depth == len - 1;
+
+      // The result must end up in %rax.
+      if (last && (insn->dst != RAX || insn->op == I_CMP))
+         continue;
+
+      bool ok = true;
+      for (int v = 0; v < NFAST && ok; v++) {
+         Machine *m = &states[depth + 1][v];
+         *m = states[depth][v];
+         ok = exec(insn, m) && (!last || m->r[RAX] == fast_expected[v]);
+      }
+      if (!ok)
+         continue;
+
+      seq[depth] = *insn;
+      if (!last) {
+         search(depth + 1);
+         continue;
+      }
+
+      candidates++;
+      int lat = 0;
+      for (int i = 0; i < len; i++)
+         lat += latency(&seq[i]);
+      if (lat < best_latency && verify()) {
+         best_latency = lat;
+         memcpy(best, seq, sizeof(seq));
+      }
+   }
+} //;;;
+
+static void init_fast(void) { //:::
+   for (int v = 0; v < NFAST; v++) {
+      fast[v] = (Vector){{random_input(), random_input()}, rng()};
+      if (v == 0)
+         fast[v].in[1] = fast[v].in[0];
+      reset(&states[0][v], &fast[v]);
+      fast_expected[v] = eval(pattern, fast[v].in);
+   }
+} //;;;
+
+// Rule database lines, kept in file order so reruns produce small diffs.
+static char **db_lines;
+static int db_len;
+
+static void read_db(char *path) { //:::
+   FILE *fp = fopen(path, "r");
+   if (!fp)
+      return;
+   char *line = NULL;
+   size_t cap = 0;
+   while (getline(&line, &cap, fp) != -1) {
+      line[strcspn(line, "\n")] = '\0';
+      db_lines = realloc(db_lines, sizeof(char *) * (db_len + 1));
+      db_lines[db_len++] = strdup(line);
+   }
+   free(line);
+   fclose(fp);
+} //;;;
+
+static void put_db(char *rule) { //::: Replace the rule with the same key, or append.
+   size_t keylen = strcspn(rule, "\t") + 1;
+   for (int i = 0; i < db_len; i++) {
+      if (!strncmp(db_lines[i], rule, keylen)) {
+         db_lines[i] = rule;
+         return;
+      }
+   }
+   db_lines = realloc(db_lines, sizeof(char *) * (db_len + 1));
+   db_lines[db_len++] = rule;
+} //;;;
+
+static void write_db(char *path) { //:::
+   FILE *fp = fopen(path, "w");
+   if (!fp)
+      error("cannot open %s: %s", path, strerror(errno));
+   if (db_len == 0 || db_lines[0][0] != '#')
+      fprintf(fp, "# Generated by tools/superopt. Pattern, tab, instructions.\n");
+   for (int i = 0; i < db_len; i++)
+      fprintf(fp, "%s\n", db_lines[i]);
+   fclose(fp);
+} //;;;
+
+static int invalid_patterns;
+
+// Returns the database line for `src`, or NULL if it is not a valid
+// pattern or no sequence was found. An invalid pattern is reported and
+// counted rather than fatal, so the rules found for the others are kept.
+static char *superoptimise(char *src, int max_len) { //:::
+   char *input = calloc(1, strlen(src) + 3);
+   sprintf(input, "%s;", src);
+   int errors = error_count;
+   Function *prog = parse(tokenize(src, input));
+   if (error_count > errors || !prog->body || prog->body->next) {
+      fprintf(stderr, "%s: not a single expression, skipped\n", src);
+      invalid_patterns++;
+      return NULL;
+   }
+
+   pattern = prog->body->lhs;
+   char *key = superopt_key(pattern, inputs, &ninputs);
+   if (!key || pattern->kind == ND_VAR || pattern->kind == ND_NUM) {
+      fprintf(stderr, "%s: not a pattern: an operator over at most %d nodes and %d variables, no '/' or '=', skipped\n",
+              src, SUPEROPT_MAX_NODES, SUPEROPT_MAX_INPUTS);
+      invalid_patterns++;
+      return NULL;
+   }
+
+   build_insns();
+   init_fast();
+   best_latency = INT32_MAX;
+   candidates = 0;
+   for (len = 1; len <= max_len && best_latency == INT32_MAX; len++)
+      search(0);
+   len--;
+
+   if (best_latency == INT32_MAX) {
+      fprintf(stderr, "%s: no sequence of at most %d instructions\n", key, max_len);
+      return NULL;
+   }
+
+   char *rule;
+   size_t size;
+   FILE *out = open_memstream(&rule, &size);
+   fprintf(out, "%s\t", key);
+   for (int i = 0; i < len; i++) {
+      if (i)
+         fprintf(out, "; ");
+      print_insn(out, &best[i]);
+   }
+   fclose(out);
+
+   fprintf(stderr, "%s: %d instructions, latency %d (%ld candidates tested)\n",
+           key, len, best_latency, candidates);
+   return rule;
+} //;;;
+
+int main(int argc, char **argv) {
+   int max_len = 3;
+   char *db = "superopt.rules";
+
+   int opt;
+   while ((opt = getopt(argc, argv, "l:o:")) != -1) {
+      if (opt == 'l')
+         max_len = atoi(optarg);
+      else if (opt == 'o')
+         db = optarg;
+      else
+         error("usage: %s [-l max-length] [-o rules-file] pattern...", argv[0]);
+   }
+   if (max_len < 1 || max_len > MAX_LEN)
+      error("-l must be between 1 and %d", MAX_LEN);
+
+   read_db(db);
+   for (int i = optind; i < argc; i++) {
+      char *rule = superoptimise(argv[i], max_len);
+      if (rule)
+         put_db(rule);
+   }
+   write_db(db);
+   return invalid_patterns ? 1 : 0;
+}